@@ -1,15 +1,31 @@
-// g++ -std=c++17 10.1.1_Constants.cpp -o constants
+// g++ -std=c++17 -pthread 10.1.1_Constants.cpp -o constants
 
+#include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <charconv>
+#include <chrono>
 #include <cmath>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
 #include <limits>
 #include <map>
 #include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
 
 namespace DeskCalculator {
@@ -30,14 +46,18 @@ enum class Kind : char {
 
 struct Token {
   Kind kind;
-  string string_value;
+  string_view string_value; // valid until the next name is read
   double number_value;
 };
 
+// Reads tokens from an istream, or straight from a contiguous buffer (a
+// string or a memory-mapped file): then names are views into the buffer and
+// numbers are parsed with from_chars, without any stream calls.
 class Token_stream {
 public:
   Token_stream(istream &s) : ip{&s}, owns{false} {}
   Token_stream(istream *p) : ip{p}, owns{true} {}
+  Token_stream(string_view buf) : ip{nullptr}, owns{false} { set_input(buf); }
   ~Token_stream() { close(); }
 
   Token get();
@@ -53,17 +73,62 @@ public:
     ip = p;
     owns = true;
   }
+  // The buffer must outlive the tokens read from it.
+  void set_input(string_view buf) {
+    close();
+    ip = nullptr;
+    owns = false;
+    pos = buf.data();
+    lim = buf.data() + buf.size();
+  }
 
 private:
+  Token get_buffered();
   void close() {
     if (owns)
       delete ip;
   }
-  istream *ip;
+  istream *ip; // nullptr: read from [pos, lim)
   bool owns;
+  const char *pos = nullptr;
+  const char *lim = nullptr;
+  string name; // the last name read from an istream
   Token ct{Kind::end};
 };
 
+// A file mapped read-only into memory, as input for a Token_stream.
+class Mapped_input {
+public:
+  explicit Mapped_input(const string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw runtime_error("cannot open " + path);
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size = size_t(st.st_size);
+      void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        madvise(p, size, MADV_SEQUENTIAL);
+        data = static_cast<const char *>(p);
+      }
+    }
+    ::close(fd);
+    if (size > 0 && !data)
+      throw runtime_error("cannot map " + path);
+  }
+  Mapped_input(const Mapped_input &) = delete;
+  Mapped_input &operator=(const Mapped_input &) = delete;
+  ~Mapped_input() {
+    if (data)
+      munmap(const_cast<char *>(data), size);
+  }
+  string_view text() const { return {data, size}; }
+
+private:
+  const char *data = nullptr;
+  size_t size = 0;
+};
+
 // Error handling
 int no_of_errors;
 double error(const string &s) {
@@ -73,6 +138,8 @@ double error(const string &s) {
 }
 
 Token Token_stream::get() {
+  if (!ip)
+    return get_buffered();
   char ch;
   do { // skip whitespace except '\n'
     if (!ip->get(ch))
@@ -108,10 +175,76 @@ Token Token_stream::get() {
     return ct;
   default:
     if (isalpha(ch)) {
-      ct.string_value = ch;
+      name = ch;
       while (ip->get(ch) && isalnum(ch))
-        ct.string_value += ch;
+        name += ch;
       ip->putback(ch);
+      ct.string_value = name;
+      ct.kind = Kind::name;
+      return ct;
+    }
+    error("bad token");
+    return ct = {Kind::print};
+  }
+}
+
+// The same tokens and errors as get(), from [pos, lim).
+Token Token_stream::get_buffered() {
+  char ch;
+  do { // skip whitespace except '\n'
+    if (pos == lim)
+      return ct = {Kind::end};
+    ch = *pos++;
+  } while (ch != '\n' && isspace(static_cast<unsigned char>(ch)));
+
+  switch (ch) {
+  case ';':
+  case '\n':
+    return ct = {Kind::print};
+  case '*':
+  case '/':
+  case '+':
+  case '-':
+  case '(':
+  case ')':
+  case '=':
+    return ct = {static_cast<Kind>(ch)};
+  case '0':
+  case '1':
+  case '2':
+  case '3':
+  case '4':
+  case '5':
+  case '6':
+  case '7':
+  case '8':
+  case '9':
+  case '.': {
+    ct.kind = Kind::number;
+    auto [end, ec] = from_chars(pos - 1, lim, ct.number_value);
+    // >> also fails on an exponent without digits ("1e", "7e+"), where
+    // from_chars just stops before the 'e'.
+    const char *q = end;
+    if (ec == errc{} && q != lim && (*q == 'e' || *q == 'E')) {
+      if (++q != lim && (*q == '+' || *q == '-'))
+        ++q;
+      if (q == lim || !isdigit(static_cast<unsigned char>(*q)))
+        ec = errc::invalid_argument;
+    }
+    if (ec != errc{}) { // like a failed >>: 0, and no more input
+      ct.number_value = 0;
+      pos = lim;
+      return ct;
+    }
+    pos = end;
+    return ct;
+  }
+  default:
+    if (isalpha(static_cast<unsigned char>(ch))) {
+      const char *start = pos - 1;
+      while (pos != lim && isalnum(static_cast<unsigned char>(*pos)))
+        ++pos;
+      ct.string_value = string_view(start, pos - start);
       ct.kind = Kind::name;
       return ct;
     }
@@ -121,7 +254,60 @@ Token Token_stream::get() {
 }
 
 Token_stream ts{cin};
-map<string, double> table;
+// The variables. Each name is interned once into a dense id, and the values
+// are a flat array indexed by id, so code compiled against ids reads a
+// variable with one indexed load. The by-name interface (table["x"], find,
+// iteration over name/value pairs) remains for callers that inspect them.
+// Adding a variable may move the values, so a reference from operator[] or
+// value() must not be held across an intern(); hold the id instead.
+class Symbol_table {
+public:
+  // The id of name, adding the variable (with value 0) if it is new.
+  int intern(string_view name) {
+    auto p = ids.find(name);
+    if (p != ids.end())
+      return p->second;
+    names.emplace_back(name);
+    values.push_back(0);
+    int id = int(values.size()) - 1;
+    ids.emplace(names.back(), id); // keys view the strings in names
+    return id;
+  }
+  int find(string_view name) const { // -1 if there is no such variable
+    auto p = ids.find(name);
+    return p == ids.end() ? -1 : p->second;
+  }
+  double &value(int id) { return values[id]; }
+  const string &name(int id) const { return names[id]; }
+  double &operator[](string_view name) { return values[intern(name)]; }
+  size_t size() const { return values.size(); }
+
+  class iterator {
+  public:
+    iterator(Symbol_table *t, int i) : tab{t}, id{i} {}
+    pair<const string &, double &> operator*() const {
+      return {tab->names[id], tab->values[id]};
+    }
+    iterator &operator++() {
+      ++id;
+      return *this;
+    }
+    bool operator!=(const iterator &b) const { return id != b.id; }
+
+  private:
+    Symbol_table *tab;
+    int id;
+  };
+  iterator begin() { return {this, 0}; }
+  iterator end() { return {this, int(values.size())}; }
+
+private:
+  unordered_map<string_view, int> ids;
+  deque<string> names; // a deque does not move its elements
+  vector<double> values;
+};
+
+Symbol_table table;
 
 double expr(bool get);
 
@@ -135,10 +321,10 @@ double prim(bool get) {
     return v;
   }
   case Kind::name: {
-    double &v = table[ts.current().string_value];
+    int id = table.intern(ts.current().string_value);
     if (ts.get().kind == Kind::assign)
-      v = expr(true);
-    return v;
+      table.value(id) = expr(true); // expr may add variables: no reference
+    return table.value(id);
   }
   case Kind::minus:
     return -prim(true);
@@ -189,6 +375,459 @@ double expr(bool get) {
   }
 }
 
+// A statement compiled to code for a stack machine. Names are resolved to
+// their table ids at compile time, so running the code does no lookups
+// and the same Program can be run any number of times. That is the fast
+// path for a formula evaluated over and over (bench(), evaluate()): compile
+// it once, then execute() it. A statement read once is cheaper to evaluate
+// with the tree walk, which is what calculate() does.
+enum class Op : char {
+  number, // push constants[arg]
+  load,   // push *slots[arg]
+  store,  // *slots[arg] = top; the value stays on the stack
+  save,   // pop into temporary arg
+  recall, // push temporary arg
+  pop,
+  neg,
+  add,
+  sub,
+  mul,
+  div // on division by 0: error, the term's value is 1, continue at arg
+};
+// The tree walk goes further after a division by 0: it abandons the term and
+// parses the remaining tokens in whatever context it returns to, possibly as
+// new statements. Code cannot do that without the tokens, so a Program only
+// matches expr() on statements that don't divide by 0.
+
+struct Instr {
+  Op op;
+  int arg;
+};
+
+struct Program {
+  vector<Instr> code;
+  vector<double> constants;
+  vector<int> slots; // table ids
+  int max_depth = 0;
+  int temps = 0; // values of shared subexpressions
+};
+
+// A parsed statement: an expression DAG in which structurally identical
+// subtrees are stored once. Children always come before their parents.
+enum class Nk : char {
+  number,
+  var,
+  assign,
+  neg,
+  add,
+  sub,
+  term, // kids combined left to right by ops (Op::mul or Op::div)
+  bad   // a '(' without its ')': kids[0] is evaluated, the value is 1
+};
+
+struct Node {
+  Nk kind;
+  double value = 0; // number
+  int var = 0;      // table id, for var and assign
+  vector<int> kids;
+  vector<Op> ops; // term: ops[k] combines kids[k + 1]
+};
+
+struct Tree {
+  vector<Node> nodes;
+  map<vector<long long>, int> index; // structure -> node
+  int root = -1;
+
+  int add(Node n) {
+    long long bits;
+    memcpy(&bits, &n.value, sizeof(bits));
+    vector<long long> key{(long long)n.kind, bits, n.var};
+    key.insert(key.end(), n.kids.begin(), n.kids.end());
+    for (Op op : n.ops)
+      key.push_back((long long)op);
+    auto p = index.find(key);
+    if (p != index.end())
+      return p->second;
+    nodes.push_back(std::move(n));
+    return index[key] = int(nodes.size()) - 1;
+  }
+  long long size(int n) const { // node count of the subtree, as a tree
+    long long s = 1;
+    for (int k : nodes[n].kids)
+      s += size(k);
+    return s;
+  }
+};
+
+// Parses like expr/term/prim, but builds a Tree instead of computing values.
+// Syntax errors are reported here; their value (1) is built in.
+class Parser {
+public:
+  Tree parse(bool get) {
+    t.root = expr(get);
+    return std::move(t);
+  }
+
+private:
+  int number(double d) {
+    Node n{Nk::number};
+    n.value = d;
+    return t.add(std::move(n));
+  }
+
+  int prim(bool get) {
+    if (get)
+      ts.get();
+    switch (ts.current().kind) {
+    case Kind::number: {
+      int n = number(ts.current().number_value);
+      ts.get();
+      return n;
+    }
+    case Kind::name: {
+      int id = table.intern(ts.current().string_value);
+      if (ts.get().kind == Kind::assign)
+        return t.add({Nk::assign, 0, id, {expr(true)}});
+      return t.add({Nk::var, 0, id});
+    }
+    case Kind::minus:
+      return t.add({Nk::neg, 0, 0, {prim(true)}});
+    case Kind::lp: {
+      int e = expr(true);
+      if (ts.current().kind != Kind::rp) {
+        error("')' expected");
+        return t.add({Nk::bad, 0, 0, {e}});
+      }
+      ts.get();
+      return e;
+    }
+    default:
+      return number(error("primary expected"));
+    }
+  }
+
+  int term(bool get) {
+    Node n{Nk::term};
+    n.kids.push_back(prim(get));
+    for (;;) {
+      switch (ts.current().kind) {
+      case Kind::mul:
+      case Kind::div:
+        n.ops.push_back(ts.current().kind == Kind::mul ? Op::mul : Op::div);
+        n.kids.push_back(prim(true));
+        break;
+      default:
+        return n.kids.size() == 1 ? n.kids[0] : t.add(std::move(n));
+      }
+    }
+  }
+
+  int expr(bool get) {
+    int left = term(get);
+    for (;;) {
+      switch (ts.current().kind) {
+      case Kind::plus:
+        left = t.add({Nk::add, 0, 0, {left, term(true)}});
+        break;
+      case Kind::minus:
+        left = t.add({Nk::sub, 0, 0, {left, term(true)}});
+        break;
+      default:
+        return left;
+      }
+    }
+  }
+
+  Tree t;
+};
+
+// Emits code for a Tree. Nodes marked shared are computed once, before the
+// statement proper, into temporaries that their uses then recall.
+class Compiler {
+public:
+  Compiler(const Tree &tree, const vector<bool> &shared_nodes)
+      : t{tree}, shared{shared_nodes}, temp(tree.nodes.size(), -1) {}
+
+  Program generate() {
+    for (size_t n = 0; n < shared.size(); ++n)
+      if (shared[n]) { // children first: n is after them
+        node(int(n));
+        temp[n] = p.temps++;
+        emit(Op::save, temp[n]);
+      }
+    gen(t.root);
+    return std::move(p);
+  }
+
+private:
+  void emit(Op op, int arg = 0) {
+    p.code.push_back({op, arg});
+    if (op == Op::number || op == Op::load || op == Op::recall)
+      p.max_depth = max(p.max_depth, ++depth);
+    else if (op != Op::store && op != Op::neg)
+      --depth;
+  }
+  void number(double d) {
+    p.constants.push_back(d);
+    emit(Op::number, int(p.constants.size()) - 1);
+  }
+  int slot(int id) {
+    for (size_t i = 0; i < p.slots.size(); ++i)
+      if (p.slots[i] == id)
+        return int(i);
+    p.slots.push_back(id);
+    return int(p.slots.size()) - 1;
+  }
+
+  void gen(int n) {
+    if (temp[n] >= 0)
+      emit(Op::recall, temp[n]);
+    else
+      node(n);
+  }
+
+  void node(int i) {
+    const Node &n = t.nodes[i];
+    switch (n.kind) {
+    case Nk::number:
+      number(n.value);
+      break;
+    case Nk::var:
+      emit(Op::load, slot(n.var));
+      break;
+    case Nk::assign:
+      gen(n.kids[0]);
+      emit(Op::store, slot(n.var));
+      break;
+    case Nk::neg:
+      gen(n.kids[0]);
+      emit(Op::neg);
+      break;
+    case Nk::add:
+    case Nk::sub:
+      gen(n.kids[0]);
+      gen(n.kids[1]);
+      emit(n.kind == Nk::add ? Op::add : Op::sub);
+      break;
+    case Nk::term: {
+      gen(n.kids[0]);
+      vector<size_t> divs; // to be pointed at the end of the term
+      for (size_t k = 1; k < n.kids.size(); ++k) {
+        gen(n.kids[k]);
+        if (n.ops[k - 1] == Op::div)
+          divs.push_back(p.code.size());
+        emit(n.ops[k - 1]);
+      }
+      for (size_t d : divs)
+        p.code[d].arg = int(p.code.size());
+      break;
+    }
+    case Nk::bad:
+      gen(n.kids[0]);
+      emit(Op::pop); // evaluated, but the value is the error's
+      number(1);
+      break;
+    }
+  }
+
+  const Tree &t;
+  const vector<bool> &shared;
+  vector<int> temp; // node -> temporary, once computed
+  Program p;
+  int depth = 0;
+};
+
+Program compile(bool get) {
+  Tree t = Parser{}.parse(get);
+  return Compiler{t, vector<bool>(t.nodes.size())}.generate();
+}
+
+// Nodes of a statement's tree, and how many of them the optimizer removed.
+struct Optimization {
+  long long nodes = 0;      // as parsed
+  long long folded = 0;     // computed at compile time
+  long long eliminated = 0; // evaluations saved by sharing subtrees
+  int shared = 0;           // subtrees computed once
+};
+
+// Folds constant subtrees. Only literals count as constants: pi and e are
+// variables like any other, and a Program must see their values when it runs,
+// not when it was compiled. Only evaluation-order-safe folds are made: a
+// leading run of constant factors in a term, operands of + and - that are
+// both constant, and never a division by 0, which stays a run-time error.
+Tree fold(const Tree &t) {
+  Tree f;
+  vector<int> to(t.nodes.size()); // node in t -> node in f
+  auto number = [&](double d) {
+    Node n{Nk::number};
+    n.value = d;
+    return f.add(std::move(n));
+  };
+  auto is_number = [&](int n) { return f.nodes[n].kind == Nk::number; };
+  auto value = [&](int n) { return f.nodes[n].value; };
+
+  for (size_t i = 0; i < t.nodes.size(); ++i) {
+    Node n = t.nodes[i];
+    for (int &k : n.kids)
+      k = to[k];
+    switch (n.kind) {
+    case Nk::neg:
+      to[i] = is_number(n.kids[0]) ? number(-value(n.kids[0])) : f.add(n);
+      break;
+    case Nk::add:
+    case Nk::sub:
+      if (is_number(n.kids[0]) && is_number(n.kids[1]))
+        to[i] = number(n.kind == Nk::add ? value(n.kids[0]) + value(n.kids[1])
+                                         : value(n.kids[0]) - value(n.kids[1]));
+      else
+        to[i] = f.add(n);
+      break;
+    case Nk::term: {
+      size_t k = 1;
+      if (is_number(n.kids[0])) {
+        double acc = value(n.kids[0]);
+        for (; k < n.kids.size() && is_number(n.kids[k]); ++k) {
+          if (n.ops[k - 1] == Op::mul)
+            acc *= value(n.kids[k]);
+          else if (value(n.kids[k]) != 0)
+            acc /= value(n.kids[k]);
+          else
+            break;
+        }
+        if (k > 1) {
+          Node rest{Nk::term};
+          rest.kids.push_back(number(acc));
+          rest.kids.insert(rest.kids.end(), n.kids.begin() + k, n.kids.end());
+          rest.ops.assign(n.ops.begin() + (k - 1), n.ops.end());
+          n = std::move(rest);
+        }
+      }
+      to[i] = n.kids.size() == 1 ? n.kids[0] : f.add(n);
+      break;
+    }
+    default:
+      to[i] = f.add(n);
+    }
+  }
+  f.root = to[t.root];
+  return f;
+}
+
+// Marks the subtrees worth computing once: those evaluated more than once
+// that are not a single number or variable and can neither change anything
+// nor fail. So a subtree is not shared if it contains an assignment, reads a
+// variable the statement assigns, or divides by anything but a nonzero
+// constant; divide-by-zero errors are reported exactly as without sharing.
+vector<bool> common_subexpressions(const Tree &t, long long &evaluations) {
+  const size_t N = t.nodes.size();
+  vector<bool> assigned(table.size()), pure(N), shared(N);
+  for (const Node &n : t.nodes)
+    if (n.kind == Nk::assign)
+      assigned[n.var] = true;
+  for (size_t i = 0; i < N; ++i) { // children first
+    const Node &n = t.nodes[i];
+    bool ok = n.kind != Nk::assign && n.kind != Nk::bad &&
+              !(n.kind == Nk::var && assigned[n.var]);
+    for (size_t k = 0; k < n.kids.size(); ++k) {
+      ok = ok && pure[n.kids[k]];
+      if (n.kind == Nk::term && k > 0 && n.ops[k - 1] == Op::div) {
+        const Node &d = t.nodes[n.kids[k]];
+        ok = ok && d.kind == Nk::number && d.value != 0;
+      }
+    }
+    pure[i] = ok;
+  }
+
+  vector<long long> evals(N); // how often each node is evaluated
+  evals[t.root] = 1;
+  evaluations = 0;
+  for (size_t i = N; i-- > 0;) { // parents first
+    const Node &n = t.nodes[i];
+    if (evals[i] == 0)
+      continue;
+    shared[i] = pure[i] && evals[i] > 1 && !n.kids.empty();
+    long long times = shared[i] ? 1 : evals[i];
+    evaluations += times;
+    for (int k : n.kids)
+      evals[k] += times;
+  }
+  return shared;
+}
+
+Program compile_optimized(bool get, Optimization &report) {
+  Tree t = Parser{}.parse(get);
+  Tree f = fold(t);
+  long long evaluations;
+  vector<bool> shared = common_subexpressions(f, evaluations);
+  report.nodes = t.size(t.root);
+  report.folded = report.nodes - f.size(f.root);
+  report.eliminated = f.size(f.root) - evaluations;
+  report.shared = int(count(shared.begin(), shared.end(), true));
+  return Compiler{f, shared}.generate();
+}
+
+// slot(i) is the variable behind slot i: the table entry, or a local copy.
+template <class Slot> double run(const Program &p, Slot slot) {
+  thread_local vector<double> memory; // the stack, then the temporaries
+  if (memory.size() < size_t(p.max_depth + p.temps))
+    memory.resize(p.max_depth + p.temps);
+  double *sp = memory.data(); // one past the top
+  double *temps = sp + p.max_depth;
+  const Instr *code = p.code.data();
+  for (size_t pc = 0, n = p.code.size(); pc < n; ++pc) {
+    const Instr &i = code[pc];
+    switch (i.op) {
+    case Op::number:
+      *sp++ = p.constants[i.arg];
+      break;
+    case Op::load:
+      *sp++ = slot(i.arg);
+      break;
+    case Op::store:
+      slot(i.arg) = sp[-1];
+      break;
+    case Op::save:
+      temps[i.arg] = *--sp;
+      break;
+    case Op::recall:
+      *sp++ = temps[i.arg];
+      break;
+    case Op::pop:
+      --sp;
+      break;
+    case Op::neg:
+      sp[-1] = -sp[-1];
+      break;
+    case Op::add:
+      --sp;
+      sp[-1] += *sp;
+      break;
+    case Op::sub:
+      --sp;
+      sp[-1] -= *sp;
+      break;
+    case Op::mul:
+      --sp;
+      sp[-1] *= *sp;
+      break;
+    case Op::div:
+      --sp;
+      if (*sp) {
+        sp[-1] /= *sp;
+      } else {
+        sp[-1] = error("divide by 0");
+        pc = i.arg - 1;
+      }
+      break;
+    }
+  }
+  return sp[-1];
+}
+
+double execute(const Program &p) {
+  return run(p, [&p](int i) -> double & { return table.value(p.slots[i]); });
+}
+
 void calculate() {
   for (;;) {
     ts.get();
@@ -200,6 +839,238 @@ void calculate() {
   }
 }
 
+// Batch evaluation: one Program over many rows of variable values.
+struct Column {
+  string name;
+  const double *values; // one per row
+};
+
+constexpr size_t batch_rows = 512; // rows per block
+
+// Evaluates p for rows [0, rows), with each variable that has a Column taken
+// from it and all other variables from the table, and writes out[row].
+// Assignments in p apply to the row only; the table is not changed.
+//
+// Each block of rows is run one instruction at a time over the whole block
+// (simple loops the compiler vectorizes), blocks are spread over threads.
+// Division is done for every row; rows that divided by zero are then re-run
+// one at a time, in row order, with exactly execute()'s semantics and error
+// reporting.
+void evaluate(const Program &p, const vector<Column> &columns, size_t rows,
+              double *out, int threads = 0) {
+  const size_t nslots = p.slots.size();
+  vector<const double *> bound(nslots, nullptr);
+  for (const Column &c : columns)
+    for (size_t s = 0; s < nslots; ++s)
+      if (p.slots[s] == table.find(c.name))
+        bound[s] = c.values;
+
+  const size_t blocks = (rows + batch_rows - 1) / batch_rows;
+  if (threads <= 0)
+    threads = max(1u, thread::hardware_concurrency());
+  threads = int(min<size_t>(threads, blocks));
+  atomic<size_t> next_block{0};
+  vector<vector<size_t>> failed(threads); // rows to re-run, per thread
+
+  auto work = [&](int t) {
+    const size_t B = batch_rows;
+    vector<double> buf(max(p.max_depth, 1) * B); // stack level d: buf + d*B
+    vector<const double *> in(max(p.max_depth, 1)); // what level d holds
+    vector<double> local(nslots * B);               // assigned variables
+    vector<double> saved(p.temps * B);              // temporaries
+    vector<const double *> src(nslots);
+    vector<unsigned char> bad(B);
+
+    for (size_t b; (b = next_block.fetch_add(1)) < blocks;) {
+      const size_t base = b * B, n = min(B, rows - base);
+      for (size_t s = 0; s < nslots; ++s)
+        src[s] = bound[s] ? bound[s] + base : nullptr;
+      fill(bad.begin(), bad.end(), 0);
+      auto fill_level = [&](int d, double v) {
+        double *o = &buf[d * B];
+        for (size_t r = 0; r < n; ++r)
+          o[r] = v;
+        in[d] = o;
+      };
+
+      int d = 0; // stack depth
+      for (const Instr &i : p.code) {
+        switch (i.op) {
+        case Op::number:
+          fill_level(d++, p.constants[i.arg]);
+          break;
+        case Op::load:
+          if (src[i.arg] == &local[i.arg * B]) { // may be overwritten
+            copy(src[i.arg], src[i.arg] + n, &buf[d * B]);
+            in[d] = &buf[d * B];
+            ++d;
+          } else if (src[i.arg]) {
+            in[d++] = src[i.arg];
+          } else {
+            fill_level(d++, table.value(p.slots[i.arg]));
+          }
+          break;
+        case Op::store:
+          copy(in[d - 1], in[d - 1] + n, &local[i.arg * B]);
+          src[i.arg] = &local[i.arg * B];
+          break;
+        case Op::save:
+          --d;
+          copy(in[d], in[d] + n, &saved[i.arg * B]);
+          break;
+        case Op::recall: // each temporary is saved once, before any recall
+          in[d++] = &saved[i.arg * B];
+          break;
+        case Op::pop:
+          --d;
+          break;
+        case Op::neg: {
+          const double *a = in[d - 1];
+          double *o = &buf[(d - 1) * B];
+          for (size_t r = 0; r < n; ++r)
+            o[r] = -a[r];
+          in[d - 1] = o;
+          break;
+        }
+        default: { // binary operators
+          --d;
+          const double *a = in[d - 1], *c = in[d];
+          double *o = &buf[(d - 1) * B];
+          switch (i.op) {
+          case Op::add:
+            for (size_t r = 0; r < n; ++r)
+              o[r] = a[r] + c[r];
+            break;
+          case Op::sub:
+            for (size_t r = 0; r < n; ++r)
+              o[r] = a[r] - c[r];
+            break;
+          case Op::mul:
+            for (size_t r = 0; r < n; ++r)
+              o[r] = a[r] * c[r];
+            break;
+          default: // Op::div
+            for (size_t r = 0; r < n; ++r) {
+              bad[r] |= c[r] == 0;
+              o[r] = a[r] / c[r];
+            }
+          }
+          in[d - 1] = o;
+        }
+        }
+      }
+      copy(in[0], in[0] + n, out + base);
+      for (size_t r = 0; r < n; ++r)
+        if (bad[r])
+          failed[t].push_back(base + r);
+    }
+  };
+
+  vector<thread> pool;
+  for (int t = 1; t < threads; ++t)
+    pool.emplace_back(work, t);
+  work(0);
+  for (auto &th : pool)
+    th.join();
+
+  vector<size_t> redo;
+  for (auto &f : failed)
+    redo.insert(redo.end(), f.begin(), f.end());
+  sort(redo.begin(), redo.end());
+  vector<double> vars(nslots);
+  for (size_t row : redo) {
+    for (size_t s = 0; s < nslots; ++s)
+      vars[s] = bound[s] ? bound[s][row] : table.value(p.slots[s]);
+    out[row] = run(p, [&vars](int i) -> double & { return vars[i]; });
+  }
+}
+
+// Runs every statement of src without printing: re-parsing it, or compiling
+// it once into Programs.
+double tree_walk(string_view src) {
+  ts.set_input(src);
+  double v = 0;
+  for (;;) {
+    ts.get();
+    if (ts.current().kind == Kind::end)
+      break;
+    if (ts.current().kind != Kind::print)
+      v = expr(false);
+  }
+  ts.set_input(cin);
+  return v;
+}
+
+vector<Program> compile_all(string_view src) {
+  ts.set_input(src);
+  vector<Program> programs;
+  for (;;) {
+    ts.get();
+    if (ts.current().kind == Kind::end)
+      break;
+    if (ts.current().kind != Kind::print)
+      programs.push_back(compile(false));
+  }
+  ts.set_input(cin);
+  return programs;
+}
+
+void bench(int runs = 1000000) {
+  table["pi"] = 3.1415926535897932385;
+  table["e"] = 2.7182818284590452354;
+  string src = "r = 2.5; area = pi * r * r; x = (area - r) / (r + 1) * 3 - -r;";
+
+  using namespace std::chrono;
+  double v1 = 0, v2 = 0;
+  auto t0 = steady_clock::now();
+  for (int i = 0; i < runs; ++i)
+    v1 = tree_walk(src);
+  auto t1 = steady_clock::now();
+  vector<Program> programs = compile_all(src);
+  for (int i = 0; i < runs; ++i)
+    for (const Program &p : programs)
+      v2 = execute(p);
+  auto t2 = steady_clock::now();
+
+  cout << runs << " runs of \"" << src << "\"\n";
+  cout << "tree walk: " << duration<double, nano>(t1 - t0).count() / runs
+       << " ns/run, bytecode: " << duration<double, nano>(t2 - t1).count() / runs
+       << " ns/run (" << v1 << " == " << v2 << ")\n";
+}
+
+// One formula over `rows` rows of x and y: a calculate()-style loop that sets
+// the table and runs the bytecode per row, against evaluate().
+void bench_batch(size_t rows = 10000000) {
+  table["pi"] = 3.1415926535897932385;
+  vector<Program> programs = compile_all("(x * 2.5 + y) / (x - y + 0.5) - pi * x");
+  const Program &p = programs[0];
+  vector<double> x(rows), y(rows), out1(rows), out2(rows);
+  for (size_t r = 0; r < rows; ++r) {
+    x[r] = double(r % 1000);
+    y[r] = double(r % 997) + 0.25;
+  }
+
+  using namespace std::chrono;
+  auto t0 = steady_clock::now();
+  const int tx = table.intern("x"), ty = table.intern("y");
+  for (size_t r = 0; r < rows; ++r) {
+    table.value(tx) = x[r];
+    table.value(ty) = y[r];
+    out1[r] = execute(p);
+  }
+  auto t1 = steady_clock::now();
+  evaluate(p, {{"x", x.data()}, {"y", y.data()}}, rows, out2.data(), 1);
+  auto t2 = steady_clock::now();
+  evaluate(p, {{"x", x.data()}, {"y", y.data()}}, rows, out2.data());
+  auto t3 = steady_clock::now();
+
+  auto ns = [&](auto d) { return duration<double, nano>(d).count() / rows; };
+  cout << rows << " rows: per row " << ns(t1 - t0) << " ns, batch "
+       << ns(t2 - t1) << " ns, batch on " << thread::hardware_concurrency()
+       << " threads " << ns(t3 - t2) << " ns per row ("
+       << (out1 == out2 ? "same results" : "DIFFERENT results") << ")\n";
+}
+
 void main_driver(istream *input = nullptr) {
   if (input) {
     ts.set_input(*input);
@@ -211,6 +1082,180 @@ void main_driver(istream *input = nullptr) {
   calculate();
 }
 
+// A compiled statement must give the value and make the assignments the tree
+// walk does, including where folding and shared subexpressions change the
+// code. Statements that divide by 0 are left out (see Op::div).
+void test_compiled() {
+  const char *scripts[] = {
+      "x = 3; y = x * x - 2 * x + 1; y\n",
+      "a = (b = 2) * (c = b + 1) - -c; a; b; c\n",
+      "r = 2; 4 / 3 * pi * r * r * r; r = r + 1; 4 / 3 * pi * r * r * r\n",
+      "v = 1.5; w = (v + 1) * (v + 1) / ((v + 1) * 2) + (v + 1); w\n",
+      "k = 2 * 3 + 4 * 5 - 6 / 3; k = k * (k = 2) + k; k\n",
+      "e * e - (2 - -e) / (1 + 1) * (z = e)\n",
+  };
+  auto run = [](const char *src, bool compiled) {
+    for (auto v : table)
+      v.second = 0;
+    table["pi"] = 3.1415926535897932385;
+    table["e"] = 2.7182818284590452354;
+    ostringstream out;
+    out.precision(17);
+    int errors = no_of_errors;
+    ts.set_input(string_view(src));
+    for (;;) {
+      ts.get();
+      if (ts.current().kind == Kind::end)
+        break;
+      if (ts.current().kind == Kind::print)
+        continue;
+      out << (compiled ? execute(compile(false)) : expr(false)) << '\n';
+    }
+    ts.set_input(cin);
+    out << no_of_errors - errors << " errors\n";
+    for (auto v : table)
+      out << v.first << " = " << v.second << '\n';
+    return out.str();
+  };
+  for (const char *src : scripts)
+    if (run(src, true) != run(src, false))
+      throw runtime_error(string("compiled code differs from the tree walk "
+                                 "on ") +
+                          src);
+  cout << "compiled code matches the tree walk on " << size(scripts)
+       << " scripts\n";
+}
+
+// n variables, referenced at random: looked up in a map<string, double> from
+// a copied token string (as before), by name in the Symbol_table, and by id
+// (as compiled code does).
+void bench_symbols(int n = 5000, int refs = 10000000) {
+  vector<string> names;
+  for (int i = 0; i < n; ++i)
+    names.push_back("variable_" + to_string(i));
+  map<string, double> old_table;
+  vector<int> ids;
+  for (const string &s : names) {
+    old_table[s] = 1;
+    ids.push_back(table.intern(s));
+    table[s] = 1;
+  }
+  vector<int> order(refs);
+  unsigned seed = 1;
+  for (int &i : order) {
+    seed = seed * 1103515245 + 12345;
+    i = (seed >> 8) % n;
+  }
+
+  using namespace std::chrono;
+  double s1 = 0, s2 = 0, s3 = 0;
+  auto t0 = steady_clock::now();
+  for (int i : order) {
+    string token = names[i]; // the copy istream tokens used to make
+    s1 += old_table[token];
+  }
+  auto t1 = steady_clock::now();
+  for (int i : order)
+    s2 += table[names[i]];
+  auto t2 = steady_clock::now();
+  for (int i : order)
+    s3 += table.value(ids[i]);
+  auto t3 = steady_clock::now();
+
+  auto ns = [&](auto d) { return duration<double, nano>(d).count() / refs; };
+  cout << n << " variables, " << refs << " references: map " << ns(t1 - t0)
+       << " ns, interned by name " << ns(t2 - t1) << " ns, by id "
+       << ns(t3 - t2) << " ns (" << s1 << " " << s2 << " " << s3 << ")\n";
+}
+
+// Tokenizes a generated script of `lines` statements from an istringstream,
+// from the string itself, and from a memory-mapped copy of it.
+void bench_tokenizer(int lines = 200000) {
+  string script;
+  for (int i = 0; i < lines; ++i)
+    script += "x" + to_string(i % 100) + " = 3.25 * y" + to_string(i % 37) +
+              " + (z - 1.5e-3) / 7;\n";
+  auto path = filesystem::temp_directory_path() / "calculator_script.txt";
+  ofstream{path} << script;
+
+  auto count = [](auto &&set) {
+    auto start = chrono::steady_clock::now();
+    set();
+    size_t tokens = 0;
+    double sum = 0;
+    while (ts.get().kind != Kind::end) {
+      ++tokens;
+      if (ts.current().kind == Kind::number)
+        sum += ts.current().number_value;
+      else if (ts.current().kind == Kind::name)
+        sum += ts.current().string_value.size();
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                start)
+                    .count();
+    cout << "  " << tokens << " tokens (checksum " << sum << ") in " << ms
+         << " ms\n";
+  };
+  cout << script.size() / (1024 * 1024.0) << " MB script\n";
+  istringstream in{script};
+  cout << "istream:";
+  count([&] { ts.set_input(in); });
+  cout << "buffer: ";
+  count([&] { ts.set_input(script); });
+  {
+    Mapped_input file{path};
+    cout << "mmap:   ";
+    count([&] { ts.set_input(file.text()); });
+  }
+  ts.set_input(cin);
+  filesystem::remove(path);
+}
+
+// Prints what the optimizer removed from each formula, then times plain and
+// optimized code for the last one.
+void bench_optimizer(int runs = 1000000) {
+  table["pi"] = 3.1415926535897932385;
+  table["e"] = 2.7182818284590452354;
+  table["r"] = 2.5;
+  table["h"] = 4;
+  const char *formulas[] = {
+      "2 * pi * r",
+      "4 / 3 * 3.1415926535897932385 * r * r * r - -1",
+      "pi * r * r * h / 3",
+      "(r + h) * (r + h) - 2 * (r + h) + e",
+      "area = pi * r * r; area",
+      "(r * h + 1) / (r - h) + (r * h + 1) * (r * h + 1) / (2 * pi)",
+  };
+  Program plain, optimized;
+  for (const char *f : formulas) {
+    ts.set_input(string_view(f));
+    ts.get();
+    plain = compile(false);
+    ts.set_input(string_view(f));
+    ts.get();
+    Optimization o;
+    optimized = compile_optimized(false, o);
+    cout << f << ": " << o.nodes << " nodes, " << o.folded << " folded, "
+         << o.eliminated << " eliminated by " << o.shared
+         << " shared subexpression(s)\n";
+  }
+  ts.set_input(cin);
+
+  using namespace std::chrono;
+  double v1 = 0, v2 = 0;
+  auto t0 = steady_clock::now();
+  for (int i = 0; i < runs; ++i)
+    v1 += execute(plain);
+  auto t1 = steady_clock::now();
+  for (int i = 0; i < runs; ++i)
+    v2 += execute(optimized);
+  auto t2 = steady_clock::now();
+  cout << "plain " << duration<double, nano>(t1 - t0).count() / runs
+       << " ns/run, optimized " << duration<double, nano>(t2 - t1).count() / runs
+       << " ns/run (" << (v1 == v2 ? "same results" : "DIFFERENT results")
+       << ")\n";
+}
+
 } // namespace DeskCalculator
 
 namespace ConstantExpressions {
@@ -310,6 +1355,12 @@ int main() {
     istringstream iss(input);
 
     DeskCalculator::main_driver(&iss);
+    DeskCalculator::test_compiled();
+    // DeskCalculator::bench();
+    // DeskCalculator::bench_batch();
+    // DeskCalculator::bench_symbols();
+    // DeskCalculator::bench_tokenizer();
+    // DeskCalculator::bench_optimizer();
 
   } catch (exception &e) {
     cerr << "Exception: " << e.what() << endl;
@@ -1,18 +1,36 @@
-// g++ -std=c++17 11.1.1_Memory.cpp -o memory
+// g++ -std=c++17 -pthread 11.1.1_Memory.cpp -o memory
+// Allocation profile: add -DALLOC_PROFILE -rdynamic (see AllocProfiler.h).
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
 #include <functional>
 #include <initializer_list>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
 #include <new>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <type_traits>
 #include <vector>
 
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "AllocProfiler.h"
+
 using namespace std;
 
 namespace EtcOperators {
@@ -61,35 +79,120 @@ struct Enode {
 };
 
 // Placement new example
+// A chain of blocks obtained from an upstream memory_resource. When the
+// current block is full the next one is taken (or allocated, each new block
+// twice the size of the last), so alloc() never fails short of the upstream
+// running out of memory, in which case the upstream throws bad_alloc.
 class Arena {
-  char *storage;
-  size_t size;
-  size_t used;
+  struct Block {
+    char *data;
+    size_t size;
+  };
 
 public:
-  Arena(size_t s) : size{s}, used{0}, storage{new char[s]} {}
-  ~Arena() { delete[] storage; }
-  void *alloc(size_t sz) {
-    // FIX 3: Alignment Safety
-    // Ensure the new pointer aligns with standard requirements (usually 8 or 16
-    // bytes) We calculate how many bytes we need to skip to get to the next
-    // aligned address.
-    size_t align = alignof(std::max_align_t);
-    size_t padding =
-        (align - ((reinterpret_cast<size_t>(storage) + used) % align)) % align;
-
-    if (used + sz + padding > size)
-      return nullptr;
-
-    // Move 'used' past the padding
-    used += padding;
+  struct Stats {
+    size_t blocks;    // blocks owned, including ones kept for reuse
+    size_t reserved;  // bytes in those blocks
+    size_t requested; // bytes asked for since the last reset
+    size_t padding;   // bytes skipped to align allocations
+    size_t tail;      // bytes left unused at the end of full blocks
+  };
 
-    void *p = storage + used;
-    used += sz;
-    return p;
+  // A position in the arena; rewind() frees everything allocated after it.
+  // The stats are saved with it so that blocks walked past again after a
+  // rewind don't count their tails twice.
+  struct Mark {
+    size_t block;
+    size_t used;
+    Stats stats;
+  };
+
+  Arena(size_t s,
+        std::pmr::memory_resource *up = std::pmr::new_delete_resource())
+      : upstream{up}, next_size{max<size_t>(s, 64)} {
+    add_block(0);
+  }
+  ~Arena() { release(); }
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *alloc(size_t sz, size_t align = alignof(std::max_align_t)) {
+    for (;;) {
+      if (current == blocks.size())
+        add_block(sz + align);
+      Block &b = blocks[current];
+      // FIX 3: Alignment Safety
+      // Ensure the new pointer aligns with standard requirements (usually 8 or
+      // 16 bytes) We calculate how many bytes we need to skip to get to the
+      // next aligned address.
+      size_t padding =
+          (align - ((reinterpret_cast<size_t>(b.data) + used) % align)) %
+          align;
+      if (used + padding + sz <= b.size) {
+        // Move 'used' past the padding
+        used += padding;
+        void *p = b.data + used;
+        used += sz;
+        stats.requested += sz;
+        stats.padding += padding;
+        return p;
+      }
+      stats.tail += b.size - used; // too small (or too full): try the next
+      ++current;
+      used = 0;
+    }
+  }
+
+  Mark mark() const { return {current, used, stats}; }
+  void rewind(Mark m) {
+    current = m.block;
+    used = m.used;
+    // Blocks added since the mark are kept, so only the usage counters go back.
+    stats.requested = m.stats.requested;
+    stats.padding = m.stats.padding;
+    stats.tail = m.stats.tail;
   }
-  const size_t current_size() const { return size; }
-  const size_t space_used() const { return used; }
+  // Forget every allocation but keep the blocks for the next round.
+  void reset() {
+    current = 0;
+    used = 0;
+    stats.requested = stats.padding = stats.tail = 0;
+  }
+  // Return all blocks to the upstream.
+  void release() {
+    for (auto &b : blocks)
+      upstream->deallocate(b.data, b.size, alignof(std::max_align_t));
+    blocks.clear();
+    current = used = 0;
+    stats = {};
+  }
+
+  const size_t current_size() const { return stats.reserved; }
+  const size_t space_used() const {
+    size_t n = used;
+    for (size_t i = 0; i < current && i < blocks.size(); ++i)
+      n += blocks[i].size;
+    return n;
+  }
+  const Stats &statistics() const { return stats; }
+
+private:
+  void add_block(size_t min_size) {
+    size_t size = max(next_size, min_size);
+    blocks.push_back({static_cast<char *>(upstream->allocate(
+                          size, alignof(std::max_align_t))),
+                      size});
+    next_size = size * 2;
+    stats.blocks = blocks.size();
+    stats.reserved += size;
+  }
+
+  std::pmr::memory_resource *upstream;
+  vector<Block> blocks;
+  size_t current = 0; // block being carved
+  size_t used = 0;    // bytes used in blocks[current]
+  size_t next_size;
+  Stats stats{};
 };
 
 } // namespace FreeStore
@@ -137,6 +240,30 @@ void demo() {
     cout << *p << " ";
   cout << endl;
 
+  // The arena grows instead of running out
+  Arena::Mark m = myArena.mark();
+  for (int i = 0; i < 100; ++i)
+    new (&myArena) double[16];
+  const auto &st = myArena.statistics();
+  cout << "After 100 x 128 bytes: " << st.blocks << " blocks, " << st.reserved
+       << " bytes reserved, " << st.padding << " bytes of padding, " << st.tail
+       << " bytes unused at block ends" << endl;
+
+  // Per-request scratch memory: rewind to the mark, keep the blocks
+  const size_t tail = st.tail;
+  myArena.rewind(m);
+  cout << "Rewound, space used: " << myArena.space_used() << endl;
+  // Doing the same work again walks the same blocks and ends with the same
+  // stats, instead of counting their tails a second time.
+  for (int i = 0; i < 100; ++i)
+    new (&myArena) double[16];
+  cout << "Same work again: " << st.tail << " bytes unused at block ends ("
+       << (st.tail == tail ? "unchanged" : "COUNTED TWICE") << ")" << endl;
+  myArena.rewind(m);
+  myArena.reset();
+  cout << "Reset, space used: " << myArena.space_used()
+       << ", blocks kept: " << myArena.statistics().blocks << endl;
+
   // nothrow new
   int *pHuge = new (nothrow) int[100000000]; // Allocation might fail but won't
                                              // throw with nothrow keyword
@@ -267,36 +394,68 @@ struct Struct {
   int x, y;
 };
 
-// Arena for managing destructors
+// Arena for managing destructors. Objects are registered per type, and each
+// type keeps its objects in fixed-size chunks, so there is no capacity limit
+// and clear() destroys a whole chunk with one call to a loop that invokes ~T
+// directly. Trivially destructible types register nothing.
 class DestructorArena {
-  struct DtorEntry {
-    void (*dtor)(void *);
-    void *obj;
+  static constexpr size_t chunk_size = 1024;
+  struct Chunk {
+    void *objs[chunk_size];
+    size_t count;
+    Chunk *prev;
+  };
+  struct Group {
+    void (*destroy)(void *const *, size_t); // identifies the type
+    Chunk *last;
   };
-  // Preallocated memory for destructors
-  alignas(std::max_align_t) char storage[1024];
-  size_t count = 0;
-  const size_t capacity = sizeof(storage) / sizeof(DtorEntry);
+  vector<Group> groups; // in order of each type's first registration
+  size_t recent = 0;    // index of the last group used
+
+  template <typename T> static void destroy_run(void *const *objs, size_t n) {
+    while (n > 0)
+      static_cast<T *>(objs[--n])->~T();
+  }
+
+  Group &group(void (*destroy)(void *const *, size_t)) {
+    if (recent < groups.size() && groups[recent].destroy == destroy)
+      return groups[recent];
+    for (recent = 0; recent < groups.size(); ++recent)
+      if (groups[recent].destroy == destroy)
+        return groups[recent];
+    groups.push_back({destroy, nullptr});
+    return groups.back();
+  }
 
 public:
-  void add(void *obj, void (*dtor)(void *)) {
-    if (count < capacity) {
-      DtorEntry *entry = reinterpret_cast<DtorEntry *>(storage) + count;
-      entry->obj = obj;
-      entry->dtor = dtor;
-      count++;
-    } else {
-      cerr << "DestructorArena full!" << endl;
+  DestructorArena() = default;
+  DestructorArena(const DestructorArena &) = delete;
+  DestructorArena &operator=(const DestructorArena &) = delete;
+
+  template <typename T> void add(T *obj) {
+    if constexpr (!std::is_trivially_destructible<T>::value) {
+      Group &g = group(&destroy_run<T>);
+      if (!g.last || g.last->count == chunk_size) {
+        Chunk *c = new Chunk;
+        c->count = 0;
+        c->prev = g.last;
+        g.last = c;
+      }
+      g.last->objs[g.last->count++] = obj;
     }
   }
 
+  // Objects of one type are destroyed in reverse order of creation, and the
+  // types in reverse order of their first registration.
   void clear() {
-    // Destroy in reverse order of creation
-    while (count > 0) {
-      count--;
-      DtorEntry *entry = reinterpret_cast<DtorEntry *>(storage) + count;
-      entry->dtor(entry->obj);
-    }
+    for (auto g = groups.rbegin(); g != groups.rend(); ++g)
+      while (Chunk *c = g->last) {
+        g->destroy(c->objs, c->count);
+        g->last = c->prev;
+        delete c;
+      }
+    groups.clear();
+    recent = 0;
   }
   ~DestructorArena() { clear(); }
 };
@@ -310,18 +469,32 @@ class Arena {
 public:
   Arena(DestructorArena &da) : dtorArena(da) {}
 
-  template <typename T, typename... Args> T *make(Args &&...args) {
+  // Raw memory, no destructor registered; nullptr when the arena is full.
+  void *allocate(size_t sz, size_t align) {
     size_t space_remaining = sizeof(storage) - used;
     void *p = storage + used;
 
     // Check if there is enough space (including alignment)
-    if (std::align(alignof(T), sizeof(T), p, space_remaining)) {
-      used = (char *)p - storage + sizeof(T);
-      T *obj = new (p) T(std::forward<Args>(args)...);
+    if (std::align(align, sz, p, space_remaining)) {
+      used = (char *)p - storage + sz;
+      return p;
+    }
+    return nullptr;
+  }
 
-      // Register destructor if T is not trivially destructible
-      if constexpr (!std::is_trivially_destructible<T>::value) {
-        dtorArena.add(obj, [](void *ptr) { static_cast<T *>(ptr)->~T(); });
+  // If registering the destructor throws (bad_alloc for a new chunk), the
+  // object is destroyed and its space given back before the exception
+  // propagates, so it neither leaks nor is left without an owner.
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    const size_t before = used;
+    if (void *p = allocate(sizeof(T), alignof(T))) {
+      T *obj = new (p) T(std::forward<Args>(args)...);
+      try {
+        dtorArena.add(obj); // no-op if T is trivially destructible
+      } catch (...) {
+        obj->~T();
+        used = before;
+        throw;
       }
       return obj;
     }
@@ -350,6 +523,54 @@ void demo() {
   cout << "End of demo scope. Destructors should fire now.\n";
 }
 
+struct Tracked {
+  int value;
+  static long destroyed;
+  ~Tracked() { destroyed += value; }
+};
+long Tracked::destroyed = 0;
+
+// Tears down n objects: one indirect call per object (the old registry)
+// against the chunked, type-batched DestructorArena.
+void bench(size_t n = 1000000, int repeats = 10) {
+  FreeStore::Arena memory(n * sizeof(Tracked));
+  Tracked *objs = static_cast<Tracked *>(
+      memory.alloc(n * sizeof(Tracked), alignof(Tracked)));
+  using Entry = pair<void (*)(void *), void *>;
+  vector<Entry> entries;
+  entries.reserve(n);
+
+  auto time = [&](auto &&f) {
+    double best = 1e30;
+    for (int r = 0; r < repeats; ++r) {
+      auto start = chrono::steady_clock::now();
+      f();
+      best = min(best, chrono::duration<double, milli>(
+                           chrono::steady_clock::now() - start)
+                           .count());
+    }
+    return best;
+  };
+  double per_object = time([&] {
+    entries.clear();
+    for (size_t i = 0; i < n; ++i)
+      entries.push_back({[](void *p) { static_cast<Tracked *>(p)->~Tracked(); },
+                         new (objs + i) Tracked{1}});
+    while (!entries.empty()) {
+      entries.back().first(entries.back().second);
+      entries.pop_back();
+    }
+  });
+  double batched = time([&] {
+    DestructorArena da;
+    for (size_t i = 0; i < n; ++i)
+      da.add(new (objs + i) Tracked{1});
+  });
+  cout << n << " objects, register + destroy: per-object calls " << per_object
+       << " ms, type-batched " << batched << " ms (" << Tracked::destroyed
+       << " destroyed)" << endl;
+}
+
 } // namespace ComplexArena
 
 namespace UniquePtrArena {
@@ -360,35 +581,103 @@ struct Widget {
   ~Widget() { cout << "Widget destroyed: " << value << endl; }
 };
 
+// Objects freed in reverse order of allocation (the usual case for scoped
+// objects) give their bytes back: the deleter rolls the offset back to where
+// it was before the allocation. Other frees only run the destructor; their
+// bytes come back when every object in the arena is gone. With debug set,
+// the arena keeps a stack of live objects and reports out-of-order frees.
 class Arena {
   alignas(std::max_align_t) char buffer[2048];
   size_t offset = 0;
+  size_t live = 0;
+  bool debug;
+  vector<void *> stack; // live objects, oldest first (debug only)
 
 public:
+  struct Stats {
+    size_t allocated;    // bytes, alignment padding included
+    size_t reclaimed;    // bytes given back by LIFO frees
+    size_t out_of_order; // frees that were not of the newest object
+  };
+
+  explicit Arena(bool debug_frees = false) : debug{debug_frees} {}
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  // Runs the destructor, then reclaims the bytes if p is the newest object.
+  template <typename T> class Deleter {
+  public:
+    Deleter(Arena *a, size_t before) : arena{a}, prev_offset{before} {}
+    void operator()(T *p) const {
+      p->~T();
+      arena->release(p, sizeof(T), prev_offset);
+    }
+
+  private:
+    Arena *arena;
+    size_t prev_offset; // arena offset before this object was allocated
+  };
+  template <typename T> using Ptr = std::unique_ptr<T, Deleter<T>>;
+
   // Allocates raw memory for T
   template <typename T> T *allocate() {
     size_t space_remaining = sizeof(buffer) - offset;
     void *ptr = buffer + offset;
     if (std::align(alignof(T), sizeof(T), ptr, space_remaining)) {
-      offset = (char *)ptr - buffer + sizeof(T);
+      size_t end = (char *)ptr - buffer + sizeof(T);
+      stats.allocated += end - offset;
+      offset = end;
       return static_cast<T *>(ptr);
     }
     return nullptr;
   }
 
   // Creates a unique_ptr managed object in the arena
-  template <typename T, typename... Args> auto make(Args &&...args) {
+  template <typename T, typename... Args> Ptr<T> make(Args &&...args) {
+    size_t before = offset;
     T *ptr = allocate<T>();
     if (!ptr) {
       throw std::bad_alloc();
     }
-    new (ptr) T(std::forward<Args>(args)...);
-
-    // Custom deleter: Calls destructor, does NOT free memory
-    auto deleter = [](T *p) { p->~T(); };
+    try {
+      new (ptr) T(std::forward<Args>(args)...);
+    } catch (...) {
+      offset = before;
+      throw;
+    }
+    ++live;
+    if (debug)
+      stack.push_back(ptr);
+    return Ptr<T>(ptr, Deleter<T>{this, before});
+  }
 
-    return std::unique_ptr<T, decltype(deleter)>(ptr, deleter);
+  size_t used() const { return offset; }
+  const Stats &statistics() const { return stats; }
+
+private:
+  void release(void *p, size_t sz, size_t prev_offset) {
+    if (debug) {
+      if (stack.back() != p) {
+        cerr << "UniquePtrArena: out-of-order free of " << p << " (newest is "
+             << stack.back() << ")" << endl;
+        stack.erase(find(stack.begin(), stack.end(), p));
+      } else {
+        stack.pop_back();
+      }
+    }
+    if ((char *)p + sz == buffer + offset) {
+      stats.reclaimed += offset - prev_offset;
+      offset = prev_offset;
+    } else {
+      ++stats.out_of_order;
+    }
+    if (--live == 0) { // everything is gone, out-of-order frees included
+      stats.reclaimed += offset;
+      offset = 0;
+    }
   }
+
+  Stats stats{};
 };
 
 void demo() {
@@ -402,29 +691,283 @@ void demo() {
   } // w1, w2 go out of scope here -> destructors called automatically
 
   cout << "Outside scope: Widgets should be destroyed.\n";
+  cout << "Bytes in use after the scope: " << arena.used() << endl;
+
+  // A long-lived arena serving scoped objects does not grow.
+  for (int i = 0; i < 1000; ++i) {
+    auto a = arena.make<int>(i);
+    auto b = arena.make<double>(i);
+  }
+  Arena::Stats s = arena.statistics();
+  cout << "1000 scopes: " << s.allocated << " bytes allocated, " << s.reclaimed
+       << " reclaimed, " << arena.used() << " in use" << endl;
+
+  Arena checked{true};
+  auto first = checked.make<int>(1);
+  auto second = checked.make<int>(2);
+  first.reset(); // not the newest: reported, bytes stay until second is freed
+  cout << "Out-of-order frees: " << checked.statistics().out_of_order
+       << ", bytes in use: " << checked.used() << endl;
 }
 
 } // namespace UniquePtrArena
 
+namespace ThreadLocalArena {
+// ComplexArena::Arena and UniquePtrArena::Arena must not be shared between
+// threads. Here every thread bump-allocates from its own arena; only the
+// refill (and the return of used blocks) goes through a lock, and it moves
+// several blocks at a time.
+
+constexpr size_t block_size = 64 * 1024;
+constexpr size_t refill_batch = 4;         // blocks taken per trip to the pool
+constexpr size_t large_size = block_size / 4; // bigger requests bypass blocks
+
+class BlockPool {
+public:
+  ~BlockPool() {
+    for (char *b : free_blocks)
+      ::operator delete(b);
+  }
+
+  void take(vector<char *> &out, size_t n) {
+    unique_lock<mutex> lock{m};
+    while (n > 0 && !free_blocks.empty()) {
+      out.push_back(free_blocks.back());
+      free_blocks.pop_back();
+      --n;
+    }
+    lock.unlock();
+    for (; n > 0; --n) {
+      out.push_back(static_cast<char *>(::operator new(block_size)));
+      ++created;
+    }
+  }
+
+  // Takes ownership of every block in blocks and empties it.
+  void give(vector<char *> &blocks) {
+    unique_lock<mutex> lock{m};
+    free_blocks.insert(free_blocks.end(), blocks.begin(), blocks.end());
+    lock.unlock();
+    blocks.clear();
+  }
+
+  size_t blocks_created() const { return created; }
+
+private:
+  mutex m;
+  vector<char *> free_blocks;
+  atomic<size_t> created{0};
+};
+
+// Constructed on first use, so it outlives every thread's arena.
+BlockPool &pool() {
+  static BlockPool p;
+  return p;
+}
+
+class LocalArena {
+public:
+  LocalArena() = default;
+  LocalArena(const LocalArena &) = delete;
+  LocalArena &operator=(const LocalArena &) = delete;
+  ~LocalArena() {
+    end_request();
+    pool().give(spare);
+  }
+
+  void *allocate(size_t sz, size_t align = alignof(std::max_align_t)) {
+    size_t padding = (align - reinterpret_cast<size_t>(cur) % align) % align;
+    if (cur && padding + sz <= size_t(end - cur)) {
+      void *p = cur + padding;
+      cur += padding + sz;
+      return p;
+    }
+    return allocate_slow(sz, align);
+  }
+
+  // Everything allocated since the last end_request() is gone; used blocks
+  // go back to the pool in one batch.
+  void end_request() {
+    pool().give(used);
+    for (auto &l : large)
+      ::operator delete(l.first, std::align_val_t{l.second});
+    large.clear();
+    cur = end = nullptr;
+  }
+
+private:
+  void *allocate_slow(size_t sz, size_t align) {
+    if (sz + align > large_size) {
+      void *p = ::operator new(sz, std::align_val_t{align});
+      large.push_back({p, align});
+      return p;
+    }
+    if (spare.empty())
+      pool().take(spare, refill_batch);
+    cur = spare.back();
+    end = cur + block_size;
+    spare.pop_back();
+    used.push_back(cur);
+    return allocate(sz, align);
+  }
+
+  char *cur = nullptr; // free space in the current block: [cur, end)
+  char *end = nullptr;
+  vector<char *> used;  // blocks carved during this request
+  vector<char *> spare; // taken from the pool but not yet used
+  vector<pair<void *, size_t>> large;
+};
+
+// This thread's arena; its destructor hands the blocks back when the thread
+// exits.
+LocalArena &arena() {
+  thread_local LocalArena local;
+  return local;
+}
+
+// Objects are never destroyed individually, so only trivially destructible
+// types are allowed (see ComplexArena for the general case).
+template <typename T, typename... Args> T *make(Args &&...args) {
+  static_assert(is_trivially_destructible<T>::value,
+                "ThreadLocalArena::make needs a trivially destructible type");
+  return new (arena().allocate(sizeof(T), alignof(T)))
+      T(std::forward<Args>(args)...);
+}
+void end_request() { arena().end_request(); }
+
+// Every thread serves `requests` requests; each allocates `objects` objects
+// of 16..256 bytes, writes to them and then frees them all, through malloc or
+// through the thread-local arena.
+void bench(int max_threads = 32, int requests = 2000, int objects = 256) {
+  auto run = [&](int threads, bool use_arena) {
+    auto work = [&](unsigned seed) {
+      vector<void *> live(objects);
+      for (int r = 0; r < requests; ++r) {
+        for (int i = 0; i < objects; ++i) {
+          seed = seed * 1103515245 + 12345;
+          size_t sz = 16 + (seed >> 16) % 241;
+          live[i] = use_arena ? arena().allocate(sz) : malloc(sz);
+          static_cast<char *>(live[i])[0] = char(i);
+        }
+        if (use_arena)
+          end_request();
+        else
+          for (void *p : live)
+            free(p);
+      }
+    };
+    auto start = chrono::steady_clock::now();
+    vector<thread> ts;
+    for (int t = 0; t < threads; ++t)
+      ts.emplace_back(work, t + 1);
+    for (auto &t : ts)
+      t.join();
+    double s =
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return double(threads) * requests * objects / s / 1e6;
+  };
+
+  cout << "threads\tmalloc Mallocs/s\tarena Mallocs/s" << endl;
+  for (int threads = 1; threads <= max_threads; threads *= 2)
+    cout << threads << '\t' << run(threads, false) << '\t'
+         << run(threads, true) << endl;
+  cout << "blocks created: " << pool().blocks_created() << endl;
+}
+
+void demo() {
+  cout << "\n--- ThreadLocalArena Demo ---\n";
+  vector<thread> workers;
+  for (int t = 0; t < 4; ++t)
+    workers.emplace_back([t] {
+      for (int request = 0; request < 3; ++request) {
+        int *values = static_cast<int *>(
+            arena().allocate(1000 * sizeof(int), alignof(int)));
+        for (int i = 0; i < 1000; ++i)
+          values[i] = t;
+        end_request();
+      }
+    });
+  for (auto &w : workers)
+    w.join();
+  cout << "4 threads x 3 requests, blocks taken from upstream: "
+       << pool().blocks_created() << endl;
+}
+} // namespace ThreadLocalArena
+
 namespace StackArena {
 
-// Arena that uses a provided buffer (e.g., on the stack)
+// Arena that uses a provided buffer (e.g., on the stack). When the buffer is
+// exhausted it spills to overflow blocks from upstream, each twice the size
+// of the previous one; they are released when the arena goes out of scope.
 class Arena {
+  struct Block {
+    Block *prev;
+    size_t size; // bytes following the header
+  };
+  static_assert(sizeof(Block) % alignof(std::max_align_t) == 0, "");
+
   char *const buffer;
   const size_t size;
-  size_t offset = 0;
+  char *cur, *end; // the buffer, then the newest overflow block
+  Block *overflow = nullptr;
+  size_t next_block;
+  size_t used = 0; // bytes handed out, alignment padding included
+  size_t overflow_bytes = 0;
+  std::pmr::memory_resource *upstream;
+
+  void spill(size_t sz, size_t align) {
+    while (next_block < sz + align)
+      next_block *= 2;
+    auto *b = static_cast<Block *>(upstream->allocate(
+        sizeof(Block) + next_block, alignof(std::max_align_t)));
+    b->prev = overflow;
+    b->size = next_block;
+    overflow = b;
+    cur = reinterpret_cast<char *>(b + 1);
+    end = cur + next_block;
+    overflow_bytes += next_block;
+    next_block *= 2;
+  }
 
 public:
-  Arena(char *buf, size_t s) : buffer(buf), size(s) {}
+  Arena(char *buf, size_t s,
+        std::pmr::memory_resource *up = std::pmr::new_delete_resource())
+      : buffer(buf), size(s), cur(buf), end(buf + s),
+        next_block(max<size_t>(s, 256)), upstream(up) {}
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena() {
+    while (Block *b = overflow) {
+      overflow = b->prev;
+      upstream->deallocate(b, sizeof(Block) + b->size,
+                           alignof(std::max_align_t));
+    }
+  }
 
-  template <typename T, typename... Args> T *make(Args &&...args) {
-    size_t space_remaining = size - offset;
-    void *ptr = buffer + offset;
+  // Never nullptr: spills to the heap when the buffer is full
+  void *allocate(size_t sz, size_t align) {
+    size_t space_remaining = end - cur;
+    void *ptr = cur;
 
-    if (std::align(alignof(T), sizeof(T), ptr, space_remaining)) {
-      offset = (char *)ptr - buffer + sizeof(T);
-      return new (ptr) T(std::forward<Args>(args)...);
+    if (!std::align(align, sz, ptr, space_remaining)) {
+      spill(sz, align);
+      ptr = cur;
+      space_remaining = end - cur;
+      std::align(align, sz, ptr, space_remaining);
     }
+    used += (char *)ptr + sz - cur;
+    cur = (char *)ptr + sz;
+    return ptr;
+  }
+
+  // Nothing is freed before the arena dies, so the peak is the total.
+  size_t high_water() const { return used; }
+  bool spilled() const { return overflow != nullptr; }
+  size_t overflow_size() const { return overflow_bytes; }
+
+  template <typename T, typename... Args> T *make(Args &&...args) {
+    if (void *ptr = allocate(sizeof(T), alignof(T)))
+      return new (ptr) T(std::forward<Args>(args)...);
     return nullptr;
   }
 };
@@ -463,10 +1006,375 @@ void demo() {
   // when stackBuffer goes out of scope. Note: If Point had a destructor, we'd
   // need to manually call it or use a mechanism like UniquePtrArena to handle
   // it!
+
+  // Sizing the buffer: 1000 simulated requests, mostly small, a few large.
+  // The high-water marks say how big the buffer must be for 99% of them.
+  vector<size_t> marks;
+  int spills = 0;
+  unsigned seed = 1;
+  for (int r = 0; r < 1000; ++r) {
+    char buf[512];
+    Arena a(buf, sizeof(buf));
+    seed = seed * 1103515245 + 12345;
+    int points = (seed >> 16) % 100 < 95 ? 10 + (seed >> 8) % 20 : 200;
+    for (int i = 0; i < points; ++i)
+      a.make<Point>(i, i, i);
+    marks.push_back(a.high_water());
+    spills += a.spilled();
+  }
+  sort(marks.begin(), marks.end());
+  cout << "1000 requests with a 512-byte buffer: " << spills
+       << " spilled to the heap; 99th percentile high-water mark "
+       << marks[marks.size() * 99 / 100 - 1] << " bytes" << endl;
 }
 
 } // namespace StackArena
 
+namespace PmrAdapters {
+// std::pmr::memory_resource front ends for the arenas above. A pmr container
+// (map, vector, string, and strings inside them) built on one of these takes
+// all its memory from the arena. deallocate() does nothing: the memory comes
+// back all at once when the arena is reset or destroyed.
+
+template <class Arena> class ArenaResource : public std::pmr::memory_resource {
+public:
+  explicit ArenaResource(Arena &a) : arena{a} {}
+
+private:
+  void *do_allocate(size_t bytes, size_t align) override {
+    if (void *p = allocate_from(arena, bytes, align))
+      return p;
+    throw bad_alloc(); // fixed-size arena is full
+  }
+  void do_deallocate(void *, size_t, size_t) override {}
+  bool do_is_equal(const memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+
+  static void *allocate_from(FreeStore::Arena &a, size_t bytes, size_t align) {
+    return a.alloc(bytes, align);
+  }
+  template <class A> static void *allocate_from(A &a, size_t bytes, size_t align) {
+    return a.allocate(bytes, align);
+  }
+
+  Arena &arena;
+};
+
+using FreeStoreResource = ArenaResource<FreeStore::Arena>;
+using StackResource = ArenaResource<StackArena::Arena>;
+using ComplexResource = ArenaResource<ComplexArena::Arena>;
+
+// Passes everything through to another resource and counts the calls.
+class CountingResource : public std::pmr::memory_resource {
+public:
+  explicit CountingResource(
+      memory_resource *up = std::pmr::new_delete_resource())
+      : upstream{up} {}
+  size_t allocations = 0;
+  size_t bytes = 0;
+
+private:
+  void *do_allocate(size_t n, size_t align) override {
+    ++allocations;
+    bytes += n;
+    return upstream->allocate(n, align);
+  }
+  void do_deallocate(void *p, size_t n, size_t align) override {
+    upstream->deallocate(p, n, align);
+  }
+  bool do_is_equal(const memory_resource &other) const noexcept override {
+    return this == &other;
+  }
+  memory_resource *upstream;
+};
+
+// The shapes of the desk calculator's symbol table and of the chapter 4
+// phonebook; names are long enough to need heap storage of their own.
+void fill(std::pmr::memory_resource *r, int n) {
+  std::pmr::map<std::pmr::string, double> table{r};
+  std::pmr::vector<pair<std::pmr::string, int>> phonebook{r};
+  char name[48];
+  for (int i = 0; i < n; ++i) {
+    snprintf(name, sizeof(name), "variable_or_person_number_%d", i);
+    table.emplace(name, i * 0.5);
+    phonebook.emplace_back(name, i);
+  }
+}
+
+void bench(int n = 100000) {
+  using namespace std::chrono;
+  cout << "n = " << n << " table entries + phonebook entries" << endl;
+
+  CountingResource heap;
+  auto t0 = steady_clock::now();
+  fill(&heap, n);
+  auto t1 = steady_clock::now();
+
+  CountingResource upstream;
+  auto t2 = steady_clock::now();
+  {
+    FreeStore::Arena arena{64 * 1024, &upstream};
+    FreeStoreResource r{arena};
+    fill(&r, n);
+  }
+  auto t3 = steady_clock::now();
+
+  cout << "global heap: " << heap.allocations << " allocations, "
+       << duration<double, milli>(t1 - t0).count() << " ms" << endl;
+  cout << "arena:       " << upstream.allocations << " allocations, "
+       << duration<double, milli>(t3 - t2).count() << " ms" << endl;
+}
+
+void demo() {
+  cout << "\n--- PmrAdapters Demo ---\n";
+  {
+    CountingResource upstream;
+    FreeStore::Arena arena{4096, &upstream};
+    FreeStoreResource r{arena};
+    std::pmr::map<std::pmr::string, double> table{&r};
+    table["pi"] = 3.1415926535897932385;
+    table["a variable name too long for SSO"] = 1;
+    std::pmr::vector<std::pmr::string> names{&r};
+    for (auto &x : table)
+      names.push_back(x.first);
+    cout << "FreeStore arena: " << table.size() << " variables, "
+         << arena.statistics().requested << " bytes, " << upstream.allocations
+         << " upstream allocation(s)" << endl;
+  }
+  {
+    char stackBuffer[2048];
+    StackArena::Arena arena(stackBuffer, sizeof(stackBuffer));
+    StackResource r{arena};
+    std::pmr::vector<int> v{&r};
+    for (int i = 0; i < 100; ++i)
+      v.push_back(i);
+    cout << "Stack arena: vector of " << v.size()
+         << " ints, data on the stack: " << boolalpha
+         << ((char *)v.data() >= stackBuffer &&
+             (char *)v.data() < stackBuffer + sizeof(stackBuffer))
+         << endl;
+  }
+  {
+    ComplexArena::DestructorArena da;
+    ComplexArena::Arena arena(da);
+    ComplexResource r{arena};
+    std::pmr::string s{"a string kept in the ComplexArena storage", &r};
+    cout << "Complex arena: " << s << endl;
+  }
+}
+} // namespace PmrAdapters
+
+namespace HugePages {
+// An arena for very large working sets, such as the 400MB array in
+// FreeStore::demo. The whole capacity is reserved with one mmap: explicit
+// huge pages (MAP_HUGETLB) if the system has some set aside, otherwise a
+// 2MB-aligned mapping marked MADV_HUGEPAGE so that the kernel can back it
+// with transparent huge pages. Fewer, larger pages mean fewer TLB misses.
+
+constexpr size_t huge_page = 2 * 1024 * 1024;
+
+enum class Backing { hugetlb, transparent, small_pages };
+
+const char *name(Backing b) {
+  switch (b) {
+  case Backing::hugetlb:
+    return "MAP_HUGETLB";
+  case Backing::transparent:
+    return "MADV_HUGEPAGE";
+  default:
+    return "4K pages";
+  }
+}
+
+struct Options {
+  bool hugetlb = true;     // try explicit huge pages first
+  bool transparent = true; // false: MADV_NOHUGEPAGE, for comparison
+};
+
+class Arena {
+public:
+  explicit Arena(size_t capacity, Options opt = {})
+      : size{(capacity + huge_page - 1) / huge_page * huge_page} {
+#ifdef MAP_HUGETLB
+    if (opt.hugetlb) {
+      void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (p != MAP_FAILED) {
+        base = static_cast<char *>(p);
+        backing = Backing::hugetlb;
+        return;
+      }
+    }
+#endif
+    // Over-map by one huge page and trim, so the region is 2MB-aligned.
+    void *p = mmap(nullptr, size + huge_page, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      throw bad_alloc();
+    char *raw = static_cast<char *>(p);
+    base = reinterpret_cast<char *>(
+        (reinterpret_cast<uintptr_t>(raw) + huge_page - 1) & ~(huge_page - 1));
+    if (base != raw)
+      munmap(raw, base - raw);
+    munmap(base + size, raw + huge_page - base);
+    backing = Backing::small_pages;
+#ifdef MADV_HUGEPAGE
+    if (opt.transparent && madvise(base, size, MADV_HUGEPAGE) == 0)
+      backing = Backing::transparent;
+    else
+      madvise(base, size, MADV_NOHUGEPAGE);
+#endif
+  }
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+  ~Arena() { munmap(base, size); }
+
+  // nullptr when the capacity is used up
+  void *allocate(size_t sz, size_t align) {
+    size_t space_remaining = size - offset;
+    void *ptr = base + offset;
+    if (std::align(align, sz, ptr, space_remaining)) {
+      offset = (char *)ptr - base + sz;
+      return ptr;
+    }
+    return nullptr;
+  }
+
+  // Forgets every allocation and gives the physical pages back to the
+  // kernel; the address range stays reserved and reads as zero again.
+  void reset() {
+    size_t touched = (offset + huge_page - 1) / huge_page * huge_page;
+    if (touched)
+      madvise(base, touched, MADV_DONTNEED);
+    offset = 0;
+  }
+
+  Backing backed_by() const { return backing; }
+  size_t capacity() const { return size; }
+  size_t used() const { return offset; }
+
+private:
+  char *base = nullptr;
+  size_t size;
+  size_t offset = 0;
+  Backing backing;
+};
+
+// Runs f(begin, end) on its own thread for each of `threads` slices of
+// [0, n), each a whole number of huge pages. Thread t is pinned to the t-th
+// CPU this process may run on, so calls with the same n and threads hand
+// each slice to the same CPU every time. Pinning is best-effort: where the
+// affinity can't be set the thread runs wherever the scheduler puts it.
+template <typename F> void on_slices(size_t n, int threads, F f) {
+  threads = max(1, threads);
+  size_t share = (n + threads - 1) / threads; // rounded up: covers n % threads
+  size_t slice = (share + huge_page - 1) / huge_page * huge_page;
+  vector<int> cpus;
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof allowed, &allowed) == 0)
+    for (int c = 0; c < CPU_SETSIZE; ++c)
+      if (CPU_ISSET(c, &allowed))
+        cpus.push_back(c);
+#endif
+  vector<thread> ts;
+  for (int t = 0; t < threads; ++t) {
+    size_t begin = min(n, t * slice), end = min(n, begin + slice);
+    ts.emplace_back([=, &cpus] {
+#ifdef __linux__
+      if (!cpus.empty()) {
+        cpu_set_t one;
+        CPU_ZERO(&one);
+        CPU_SET(cpus[t % cpus.size()], &one);
+        pthread_setaffinity_np(pthread_self(), sizeof one, &one);
+      }
+#endif
+      f(begin, end);
+    });
+  }
+  for (auto &t : ts)
+    t.join();
+}
+
+// Pages are placed on the NUMA node of the thread that first writes them.
+// Zeroing [p, p+n) slice by slice with on_slices places each slice next to
+// the thread that later works on it through on_slices with the same n and
+// threads (as far as the pinning took effect).
+void first_touch(void *p, size_t n, int threads) {
+  on_slices(n, threads,
+            [p](size_t begin, size_t end) {
+              memset((char *)p + begin, 0, end - begin);
+            });
+}
+
+// AnonHugePages of this process in kB (Linux), to see whether the kernel
+// actually used transparent huge pages.
+size_t anon_huge_kb() {
+  ifstream smaps{"/proc/self/smaps_rollup"};
+  string key;
+  size_t kb = 0;
+  while (smaps >> key)
+    if (key == "AnonHugePages:" && smaps >> kb)
+      return kb;
+  return 0;
+}
+
+// Random reads over a large array: almost every access is a TLB miss with
+// 4K pages, far fewer are with 2MB pages.
+void bench(size_t bytes = size_t(1) << 30, size_t reads = 50000000) {
+  auto run = [&](Options opt) {
+    Arena arena{bytes, opt};
+    size_t n = bytes / sizeof(uint64_t);
+    auto *a = static_cast<uint64_t *>(arena.allocate(bytes, huge_page));
+    // Each slice is filled by the thread that touched it. The timed reads
+    // below run on one thread across all of them: this measures the TLB,
+    // not NUMA placement.
+    int threads = max(1u, thread::hardware_concurrency());
+    first_touch(a, bytes, threads);
+    on_slices(bytes, threads, [a](size_t begin, size_t end) {
+      for (size_t i = begin / sizeof *a; i < end / sizeof *a; ++i)
+        a[i] = i;
+    });
+    size_t huge_kb = anon_huge_kb();
+
+    auto start = chrono::steady_clock::now();
+    uint64_t x = 1, sum = 0;
+    for (size_t i = 0; i < reads; ++i) {
+      x = x * 6364136223846793005ull + 1442695040888963407ull;
+      sum += a[(x >> 17) % n];
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() -
+                                               start)
+                    .count();
+    cout << name(arena.backed_by()) << ": " << ns / reads
+         << " ns per random read, AnonHugePages " << huge_kb << " kB"
+         << (sum == 0 ? " " : "") << endl;
+  };
+  cout << bytes / (1024 * 1024) << " MB, " << reads << " random reads" << endl;
+  run({false, false});
+  run({});
+}
+
+void demo() {
+  cout << "\n--- HugePages Demo ---\n";
+  Arena arena{64 * 1024 * 1024};
+  size_t n = 10000000;
+  int *big = static_cast<int *>(arena.allocate(n * sizeof(int), alignof(int)));
+  first_touch(big, n * sizeof(int), 2);
+  on_slices(n * sizeof(int), 2, [big](size_t begin, size_t end) {
+    for (size_t i = begin / sizeof(int); i < end / sizeof(int); ++i)
+      big[i] = int(i);
+  });
+  cout << n << " ints in a " << arena.capacity() / (1024 * 1024)
+       << "MB arena backed by " << name(arena.backed_by())
+       << ", big[n-1] = " << big[n - 1] << endl;
+  arena.reset();
+  cout << "After reset: " << arena.used() << " bytes used, big[n-1] = "
+       << big[n - 1] << endl;
+}
+} // namespace HugePages
+
 int main() {
   try {
     EtcOperators::demo();
@@ -475,8 +1383,15 @@ int main() {
     Lambdas::demo();
     ExplicitConversions::demo();
     ComplexArena::demo();
+    // ComplexArena::bench();
     UniquePtrArena::demo();
+    ThreadLocalArena::demo();
+    // ThreadLocalArena::bench();
     StackArena::demo();
+    PmrAdapters::demo();
+    // PmrAdapters::bench();
+    HugePages::demo();
+    // HugePages::bench();
   } catch (const exception &e) {
     cerr << "Exception: " << e.what() << endl;
   }
@@ -8,14 +8,36 @@
  */
 
 #include <algorithm>
+#include <cctype>
+#include <climits>
+#include <chrono>
 #include <complex>
+#include <cstdint>
 #include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
 #include <vector>
+#define SLAB_POOL_CHECKS // owner() and is_free() for test_size_classes()
+#include "SlabPool.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
 
 // Global using for convenience in this pedagogical file
 using namespace std;
@@ -24,26 +46,117 @@ using namespace std;
 // 19.2.1 Subscripting
 // ==============================================================================
 namespace Subscripting {
+// Open-addressing hash table in the style of SwissTable. Each slot has one
+// control byte: "empty", or the low 7 bits of the key's hash. A probe loads 16
+// control bytes at once and compares them all against the wanted byte with
+// one SIMD instruction, so most misses never touch a key.
+//
+// The entries themselves stay in vec, in insertion order; the table only maps
+// a hash to an index into vec. vec is private, and iteration is read-only, so
+// callers cannot reorder or rename entries behind the table's back.
 struct Assoc {
-  vector<pair<string, int>> vec; // vector of {name,value} pairs
+  using const_iterator = vector<pair<string, int>>::const_iterator;
 
   // const version for reading
-  const int &operator[](const string &s) const {
-    for (const auto &x : vec)
-      if (s == x.first)
-        return x.second;
+  const int &operator[](string_view s) const {
+    if (const int *v = find(s))
+      return *v;
     throw out_of_range("Key not found: " +
-                       s); // Simple error handling for const access
+                       string{s}); // Simple error handling for const access
   }
 
   // non-const version for read/write (creates if not found)
-  int &operator[](const string &s) {
-    for (auto &x : vec)
-      if (s == x.first)
-        return x.second;
-    vec.push_back({s, 0});    // initial value: 0
+  int &operator[](string_view s) {
+    size_t h = hash<string_view>{}(s);
+    if (const int *v = find(s, h))
+      return const_cast<int &>(*v);
+    if ((vec.size() + 1) * 8 > capacity() * 7) // keep the load factor <= 7/8
+      rehash(max(capacity() * 2, group_width));
+    vec.push_back({string{s}, 0}); // initial value: 0
+    insert_slot(h, vec.size() - 1);
     return vec.back().second; // return last element
   }
+
+  // nullptr if s is not a key; never allocates.
+  const int *find(string_view s) const {
+    return find(s, hash<string_view>{}(s));
+  }
+
+  // {name,value} pairs in insertion order
+  const_iterator begin() const { return vec.begin(); }
+  const_iterator end() const { return vec.end(); }
+  size_t size() const { return vec.size(); }
+
+private:
+  vector<pair<string, int>> vec; // vector of {name,value} pairs
+
+  static constexpr size_t group_width = 16;
+  static constexpr int8_t empty = -128; // full slots hold 0..127
+
+  // capacity() + group_width bytes: the last group_width bytes mirror the
+  // first ones, so a 16-byte load starting at any slot never wraps.
+  vector<int8_t> ctrl;
+  vector<uint32_t> slots; // index into vec, valid where ctrl is full
+
+  size_t capacity() const { return slots.size(); } // 0 or a power of two
+
+  // Bit i is set if group[i] == byte.
+  static uint32_t match(const int8_t *group, int8_t byte) {
+#ifdef __SSE2__
+    __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i *>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(byte)));
+#else
+    uint32_t bits = 0;
+    for (size_t i = 0; i < group_width; ++i)
+      bits |= uint32_t(group[i] == byte) << i;
+    return bits;
+#endif
+  }
+
+  // The low 7 bits of the hash go into the control byte (H2), the rest picks
+  // the first group (H1). Groups are visited in triangular order, which covers
+  // every group of a power-of-two table.
+  const int *find(string_view s, size_t h) const {
+    if (slots.empty())
+      return nullptr;
+    size_t mask = capacity() - 1;
+    int8_t h2 = h & 0x7f;
+    size_t pos = (h >> 7) & mask;
+    for (size_t step = group_width;; step += group_width) {
+      const int8_t *group = &ctrl[pos];
+      for (uint32_t bits = match(group, h2); bits; bits &= bits - 1) {
+        const auto &entry = vec[slots[(pos + __builtin_ctz(bits)) & mask]];
+        if (entry.first == s)
+          return &entry.second;
+      }
+      if (match(group, empty))
+        return nullptr;
+      pos = (pos + step) & mask;
+    }
+  }
+
+  void insert_slot(size_t h, size_t index) {
+    size_t mask = capacity() - 1;
+    size_t pos = (h >> 7) & mask;
+    for (size_t step = group_width;; step += group_width) {
+      if (uint32_t bits = match(&ctrl[pos], empty)) {
+        size_t i = (pos + __builtin_ctz(bits)) & mask;
+        ctrl[i] = h & 0x7f;
+        if (i < group_width)
+          ctrl[capacity() + i] = ctrl[i];
+        slots[i] = index;
+        return;
+      }
+      pos = (pos + step) & mask;
+    }
+  }
+
+  void rehash(size_t new_capacity) {
+    ctrl.assign(new_capacity + group_width, empty);
+    slots.assign(new_capacity, 0);
+    for (size_t i = 0; i < vec.size(); ++i)
+      insert_slot(hash<string_view>{}(vec[i].first), i);
+  }
 };
 
 void test() {
@@ -57,13 +170,181 @@ void test() {
     ++values[w];
   }
 
-  for (const auto &x : values.vec) {
+  for (const auto &x : values) {
     cout << '{' << x.first << ',' << x.second << "}\n";
   }
+
+  const Assoc &cvalues = values;
+  cout << "const lookup apple: " << cvalues["apple"] << endl;
+  try {
+    cvalues["durian"];
+  } catch (const out_of_range &e) {
+    cout << "Caught: " << e.what() << endl;
+  }
   cout << endl;
 }
 } // namespace Subscripting
 
+// ==============================================================================
+// 19.2.1 (continued) Word counting on top of Assoc
+// ==============================================================================
+namespace WordCount {
+using Subscripting::Assoc;
+
+// Read-only view of a whole file through mmap: no copy into user memory, and
+// the kernel can read ahead because access is sequential.
+class MappedFile {
+  const char *data = nullptr;
+  size_t size = 0;
+
+public:
+  explicit MappedFile(const string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw runtime_error("MappedFile: cannot open " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      throw runtime_error("MappedFile: cannot stat " + path);
+    }
+    size = st.st_size;
+    if (size > 0) {
+      void *p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p == MAP_FAILED) {
+        close(fd);
+        throw runtime_error("MappedFile: cannot map " + path);
+      }
+      madvise(p, size, MADV_SEQUENTIAL);
+      data = static_cast<const char *>(p);
+    }
+    close(fd); // the mapping keeps the file alive
+  }
+  ~MappedFile() {
+    if (data)
+      munmap(const_cast<char *>(data), size);
+  }
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  string_view text() const { return {data, size}; }
+};
+
+bool is_space(char c) { return isspace(static_cast<unsigned char>(c)); }
+
+// Counts whitespace-separated words of text into shard.
+void count_into(string_view text, Assoc &shard) {
+  const char *p = text.data();
+  const char *end = p + text.size();
+  while (p != end) {
+    while (p != end && is_space(*p))
+      ++p;
+    const char *word = p;
+    while (p != end && !is_space(*p))
+      ++p;
+    if (p != word)
+      ++shard[string_view(word, p - word)];
+  }
+}
+
+// Splits text into one piece per thread, moving every cut forward to the next
+// whitespace so no word is split, counts each piece into its own Assoc and
+// merges the shards at the end.
+Assoc count(string_view text, unsigned threads) {
+  threads = max(1u, threads);
+  vector<size_t> cuts{0};
+  for (unsigned i = 1; i < threads; ++i) {
+    size_t c = max(cuts.back(), text.size() * i / threads);
+    while (c < text.size() && !is_space(text[c]))
+      ++c;
+    cuts.push_back(c);
+  }
+  cuts.push_back(text.size());
+
+  vector<Assoc> shards(threads);
+  vector<thread> workers;
+  for (unsigned i = 1; i < threads; ++i)
+    workers.emplace_back([&, i] {
+      count_into(text.substr(cuts[i], cuts[i + 1] - cuts[i]), shards[i]);
+    });
+  count_into(text.substr(0, cuts[1]), shards[0]);
+  for (auto &w : workers)
+    w.join();
+
+  Assoc &merged = shards[0];
+  for (unsigned i = 1; i < threads; ++i)
+    for (const auto &x : shards[i])
+      merged[x.first] += x.second;
+  return std::move(merged);
+}
+
+// The k most frequent words, most frequent first (ties alphabetically). Keeps
+// a min-heap of k entries instead of sorting every distinct word.
+vector<pair<string, int>> top_k(const Assoc &counts, size_t k) {
+  auto better = [](const pair<string, int> *a, const pair<string, int> *b) {
+    return a->second != b->second ? a->second > b->second : a->first < b->first;
+  };
+  vector<const pair<string, int> *> heap; // heap.front() is the worst kept
+  for (const auto &x : counts) {
+    if (heap.size() < k) {
+      heap.push_back(&x);
+      push_heap(heap.begin(), heap.end(), better);
+    } else if (k > 0 && better(&x, heap.front())) {
+      pop_heap(heap.begin(), heap.end(), better);
+      heap.back() = &x;
+      push_heap(heap.begin(), heap.end(), better);
+    }
+  }
+  sort_heap(heap.begin(), heap.end(), better);
+  vector<pair<string, int>> result;
+  for (auto *x : heap)
+    result.push_back(*x);
+  return result;
+}
+
+// Counts path with 1, 2, 4 ... 64 threads and prints time and speedup.
+void bench(const string &path, size_t k = 10) {
+  MappedFile file{path};
+  string_view text = file.text();
+  cout << "threads\tms\tMB/s\tspeedup" << endl;
+  double base = 0;
+  for (unsigned threads = 1; threads <= 64; threads *= 2) {
+    auto start = chrono::steady_clock::now();
+    Assoc counts = count(text, threads);
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                                start)
+                    .count();
+    if (threads == 1)
+      base = ms;
+    cout << threads << '\t' << ms << '\t' << text.size() / 1e3 / ms << '\t'
+         << base / ms << endl;
+    if (threads == 64)
+      for (const auto &x : top_k(counts, k))
+        cout << '{' << x.first << ',' << x.second << "}\n";
+  }
+}
+
+void test() {
+  cout << "--- 19.2.1 Word Count ---" << endl;
+  string path =
+      (filesystem::temp_directory_path() / "wordcount_demo.txt").string();
+  {
+    ofstream out{path};
+    vector<string> words = {"apple", "banana", "apple", "cherry", "banana",
+                            "apple", "durian"};
+    for (int i = 0; i < 10000; ++i)
+      out << words[i % words.size()] << (i % 10 == 9 ? '\n' : ' ');
+  }
+  {
+    MappedFile file{path};
+    Assoc counts = count(file.text(), 4);
+    for (const auto &x : top_k(counts, 3))
+      cout << '{' << x.first << ',' << x.second << "}\n";
+  }
+  filesystem::remove(path);
+  cout << endl;
+}
+} // namespace WordCount
+
 // ==============================================================================
 // 19.2.2 Function Call
 // ==============================================================================
@@ -273,29 +554,141 @@ void test() {
 // 19.2.5 Allocation and Deallocation
 // ==============================================================================
 namespace AllocationDeallocation {
-class Employee {
+// The class-specific operator new/delete come from the SlabAllocated mixin
+// (SlabPool.h): every Employee is carved from a size class of the slab pool.
+class Employee : public SlabAllocated<Employee> {
 public:
   string name;
   Employee(string n) : name(n) { cout << "  Employee ctor: " << name << endl; }
   ~Employee() { cout << "  Employee dtor: " << name << endl; }
-
-  static void *operator new(size_t s) {
-    cout << "  [Custom Allocator] Allocating " << s << " bytes" << endl;
-    return ::operator new(s);
-  }
-
-  static void operator delete(void *p, size_t s) {
-    cout << "  [Custom Allocator] Deallocating " << s << " bytes" << endl;
-    ::operator delete(p);
-  }
 };
 
 void test() {
   cout << "--- 19.2.5 Allocation and Deallocation ---" << endl;
   Employee *e = new Employee("John Doe");
+  auto s = Slab::stats();
+  cout << "  Slab bytes: " << s.slab_bytes
+       << ", outstanding: " << s.outstanding_bytes << endl;
   delete e;
   cout << endl;
 }
+
+// An object of exactly N bytes (the empty mixin base takes no space).
+template <size_t N> struct Blob : SlabAllocated<Blob<N>> {
+  char bytes[N];
+};
+
+// Smallest class that fits n, found without the class_of table.
+constexpr size_t expected_class(size_t n) {
+  for (size_t cls = 0; cls < Slab::num_classes; ++cls)
+    if (n <= Slab::class_sizes[cls])
+      return cls;
+  return Slab::num_classes;
+}
+
+// A Blob<N> must come from the slab of its class and, once deleted, be free in
+// that same class (not in a neighbour's).
+template <size_t N> void check_blob() {
+  static_assert(sizeof(Blob<N>) == N, "Blob<N> should be N bytes");
+  constexpr size_t cls = expected_class(N);
+  auto *p = new Blob<N>;
+  if (Slab::owner(p) != cls)
+    throw logic_error("Slab: " + to_string(N) + " bytes allocated from the "
+                      "wrong class");
+  delete p;
+  if constexpr (cls < Slab::num_classes) // heap blocks are gone after delete
+    if (!Slab::is_free(p, cls))
+      throw logic_error("Slab: " + to_string(N) + " bytes freed to the wrong "
+                        "class");
+}
+
+template <size_t... N> void check_blobs(index_sequence<N...>) {
+  (check_blob<N>(), ...);
+}
+
+// Sizes on and around every class boundary, plus the first size that goes
+// to the global heap.
+void test_size_classes() {
+  cout << "--- 19.2.5 Slab size classes ---" << endl;
+  for (size_t n = 1; n <= Slab::max_size + 1; ++n)
+    if (Slab::size_class(n) != expected_class(n))
+      throw logic_error("Slab: class_of is wrong for " + to_string(n) +
+                        " bytes");
+  check_blobs(index_sequence<1, 7, 8, 9, 15, 16, 17, 23, 24, 25, 31, 32, 33,
+                             47, 48, 49, 63, 64, 65, 95, 96, 97, 127, 128,
+                             129, 191, 192, 193, 255, 256, 257>{});
+  cout << "  All sizes routed to their class" << endl << endl;
+}
+
+// Same size and layout as FreeStore::Enode in chapter 11.
+struct Enode : SlabAllocated<Enode> {
+  char oper;
+  Enode *left;
+  Enode *right;
+};
+struct HeapEnode {
+  char oper;
+  HeapEnode *left;
+  HeapEnode *right;
+};
+
+// Allocates n nodes, frees them in random order, three rounds, then keeps a
+// random half alive to look at fragmentation.
+template <class Node> void bench_one(const char *name, int n) {
+  using namespace std::chrono;
+  const Slab::Stats before = Slab::stats(); // other classes, earlier tests
+  vector<Node *> nodes(n);
+  vector<int> order(n);
+  for (int i = 0; i < n; ++i)
+    order[i] = i;
+  unsigned seed = 1;
+  for (int i = n - 1; i > 0; --i) { // Fisher-Yates with a fixed seed
+    seed = seed * 1103515245 + 12345;
+    swap(order[i], order[(seed >> 8) % (i + 1)]);
+  }
+
+  auto start = steady_clock::now();
+  for (int round = 0; round < 3; ++round) {
+    for (int i = 0; i < n; ++i)
+      nodes[i] = new Node{};
+    for (int i : order)
+      delete nodes[i];
+  }
+  double ns = duration<double, nano>(steady_clock::now() - start).count();
+  cout << name << ": " << ns / (3.0 * n) << " ns per new+delete" << endl;
+
+  // Memory held for the live half: the slabs this bench made the pool
+  // reserve, or (for the heap) the growth of glibc's in-use byte count,
+  // which includes each block's header.
+#ifdef __GLIBC__
+  const size_t heap_before = mallinfo2().uordblks;
+#endif
+  for (int i = 0; i < n; ++i)
+    nodes[i] = new Node{};
+  for (int i = 0; i < n / 2; ++i)
+    delete nodes[order[i]];
+  cout << "  " << n - n / 2 << " live nodes of " << sizeof(Node)
+       << " bytes = " << (n - n / 2) * sizeof(Node) << " bytes";
+  if (is_base_of<SlabAllocated<Node>, Node>::value) {
+    Slab::Stats s = Slab::stats();
+    cout << ", slab reserved " << s.slab_bytes - before.slab_bytes
+         << " bytes, outstanding (live + thread cache) "
+         << s.outstanding_bytes - before.outstanding_bytes << " bytes";
+  }
+#ifdef __GLIBC__
+  else
+    cout << ", heap in use grew by " << mallinfo2().uordblks - heap_before
+         << " bytes";
+#endif
+  cout << endl;
+  for (int i = n / 2; i < n; ++i)
+    delete nodes[order[i]];
+}
+
+void bench(int n = 1000000) {
+  bench_one<HeapEnode>("default heap", n);
+  bench_one<Enode>("slab pool", n);
+}
 } // namespace AllocationDeallocation
 
 // ==============================================================================
@@ -359,6 +752,10 @@ class String {
     char ch[short_max + 1];
   };
 
+  // Short strings live in ch; once a heap buffer is in use (because the
+  // string grew or reserve() asked for room) ptr points elsewhere.
+  bool is_long() const { return ptr != ch; }
+
   void check(int n) const {
     if (n < 0 || sz <= n)
       throw out_of_range("String::at()");
@@ -373,8 +770,9 @@ class String {
 
   void copy_from(const String &x) {
     if (x.sz <= short_max) {
-      memcpy(this, &x, sizeof(x));
+      sz = x.sz;
       ptr = ch;
+      memcpy(ch, x.ptr, sz + 1);
     } else {
       ptr = expand(x.ptr, x.sz + 1);
       sz = x.sz;
@@ -383,9 +781,10 @@ class String {
   }
 
   void move_from(String &x) {
-    if (x.sz <= short_max) {
-      memcpy(this, &x, sizeof(x));
+    if (!x.is_long()) {
+      sz = x.sz;
       ptr = ch;
+      memcpy(ch, x.ch, sz + 1);
     } else {
       ptr = x.ptr;
       sz = x.sz;
@@ -411,7 +810,7 @@ public:
   String &operator=(const String &x) {
     if (this == &x)
       return *this;
-    char *p = (short_max < sz) ? ptr : 0;
+    char *p = is_long() ? ptr : 0;
     copy_from(x);
     delete[] p;
     return *this;
@@ -422,14 +821,14 @@ public:
   String &operator=(String &&x) {
     if (this == &x)
       return *this;
-    if (short_max < sz)
+    if (is_long())
       delete[] ptr;
     move_from(x);
     return *this;
   }
 
   ~String() {
-    if (short_max < sz)
+    if (is_long())
       delete[] ptr;
   }
 
@@ -445,30 +844,51 @@ public:
     return ptr[n];
   }
 
-  String &operator+=(char c) {
-    if (sz == short_max) {
-      int n = sz + sz + 2;
-      ptr = expand(ptr, n);
-      space = n - sz - 2;
-    } else if (short_max < sz) {
-      if (space == 0) {
-        int n = sz + sz + 2;
-        char *p = expand(ptr, n);
+  // Makes room for n characters without reallocating; never shrinks.
+  void reserve(int n) {
+    if (n <= capacity())
+      return;
+    char *p = new char[n + 1];
+    memcpy(p, ptr, sz + 1);
+    if (is_long())
+      delete[] ptr;
+    ptr = p;
+    space = n - sz;
+  }
+
+  // One memcpy per call. When the buffer is full the capacity at least
+  // doubles, so a sequence of appends costs amortized O(length appended).
+  // Lengths are kept below INT_MAX / 2 so that doubling cannot overflow.
+  String &append(const char *p, int n) {
+    if (n < 0 || sz < 0 || n > INT_MAX / 2 - sz)
+      throw length_error("String::append()");
+    if (capacity() - sz < n) {
+      int cap = max(sz + n, 2 * capacity());
+      char *q = new char[cap + 1];
+      memcpy(q, ptr, sz);
+      memcpy(q + sz, p, n); // before the delete: p may point into ptr
+      if (is_long())
         delete[] ptr;
-        ptr = p;
-        space = n - sz - 2;
-      } else {
-        --space;
-      }
+      ptr = q;
+      sz += n;
+      space = cap - sz;
+    } else {
+      memmove(ptr + sz, p, n);
+      sz += n;
+      if (is_long())
+        space -= n;
     }
-    ptr[sz] = c;
-    ptr[++sz] = 0;
+    ptr[sz] = 0;
     return *this;
   }
+  String &append(const String &x) { return append(x.ptr, x.sz); }
+
+  String &operator+=(char c) { return append(&c, 1); }
+  String &operator+=(const char *p) { return append(p, strlen(p)); }
 
   const char *c_str() const { return ptr; }
   int size() const { return sz; }
-  int capacity() const { return (sz <= short_max) ? short_max : sz + space; }
+  int capacity() const { return is_long() ? sz + space : short_max; }
 };
 
 // Helper functions
@@ -491,16 +911,71 @@ char *end(String &x) { return const_cast<char *>(x.c_str()) + x.size(); }
 const char *begin(const String &x) { return x.c_str(); }
 const char *end(const String &x) { return x.c_str() + x.size(); }
 
-String &operator+=(String &a, const String &b) {
-  for (auto x : b)
-    a += x;
-  return a;
-}
+String &operator+=(String &a, const String &b) { return a.append(b); }
+
+// a + b + c + ... builds a Cat that only remembers its operands. Converting it
+// to a String adds up the lengths first, allocates once and copies each piece
+// once. A String operand that is a temporary is moved into the Cat, so
+// auto s = a + String{"x"}; is safe; a named String is held by reference and
+// must outlive the Cat, as with string_view. Nested Cats are small and are
+// held by value.
+template <class L, class R> class Cat {
+  L l; // const String &, String or Cat<...>
+  R r;
+
+  static void put(String &out, const String &x) { out.append(x); }
+  template <class A, class B> static void put(String &out, const Cat<A, B> &x) {
+    x.append_to(out);
+  }
 
-String operator+(const String &a, const String &b) {
-  String res{a};
-  res += b;
-  return res;
+public:
+  template <class A, class B>
+  Cat(A &&a, B &&b) : l(std::forward<A>(a)), r(std::forward<B>(b)) {}
+  int size() const { return l.size() + r.size(); }
+  void append_to(String &out) const {
+    put(out, l);
+    put(out, r);
+  }
+  operator String() const {
+    String res;
+    res.reserve(size());
+    append_to(res);
+    return res;
+  }
+};
+
+Cat<const String &, const String &> operator+(const String &a,
+                                              const String &b) {
+  return {a, b};
+}
+Cat<String, const String &> operator+(String &&a, const String &b) {
+  return {std::move(a), b};
+}
+Cat<const String &, String> operator+(const String &a, String &&b) {
+  return {a, std::move(b)};
+}
+Cat<String, String> operator+(String &&a, String &&b) {
+  return {std::move(a), std::move(b)};
+}
+template <class A, class B>
+Cat<Cat<A, B>, const String &> operator+(Cat<A, B> a, const String &b) {
+  return {std::move(a), b};
+}
+template <class A, class B>
+Cat<Cat<A, B>, String> operator+(Cat<A, B> a, String &&b) {
+  return {std::move(a), std::move(b)};
+}
+template <class A, class B>
+Cat<const String &, Cat<A, B>> operator+(const String &a, Cat<A, B> b) {
+  return {a, std::move(b)};
+}
+template <class A, class B>
+Cat<String, Cat<A, B>> operator+(String &&a, Cat<A, B> b) {
+  return {std::move(a), std::move(b)};
+}
+template <class A, class B, class C, class D>
+Cat<Cat<A, B>, Cat<C, D>> operator+(Cat<A, B> a, Cat<C, D> b) {
+  return {std::move(a), std::move(b)};
 }
 
 void test() {
@@ -526,6 +1001,55 @@ void test() {
       "The quick brown fox jumped over the lazy dog"; // Long string (allocates)
   cout << "Long string: " << s4 << endl;
   cout << "Size: " << s4.size() << ", Capacity: " << s4.capacity() << endl;
+
+  String s5 = s2 + String{" / "} + s4; // one allocation for the result
+  cout << "Concatenated: " << s5 << endl;
+  auto s6 = s4 + String{" again"}; // the temporary is moved into the Cat
+  cout << "Deferred: " << String{s6} << endl;
+  cout << endl;
+}
+
+// Builds a string of about 1MB from pieces of 8 (short), 64 (medium) and 4096
+// (long) characters, with append and with a + b + c + d chains, against
+// std::string doing the same.
+void bench() {
+  using namespace std::chrono;
+  auto ns_per_op = [](auto start, auto end, int ops) {
+    return duration<double, nano>(end - start).count() / ops;
+  };
+  cout << "piece\tappend ns\tstd append ns\tchain ns\tstd chain ns" << endl;
+  for (int len : {8, 64, 4096}) {
+    string piece(len, 'x');
+    String p{piece.c_str()};
+    int ops = (1 << 20) / len;
+
+    auto t0 = steady_clock::now();
+    String s;
+    for (int i = 0; i < ops; ++i)
+      s.append(p);
+    auto t1 = steady_clock::now();
+    string ss;
+    for (int i = 0; i < ops; ++i)
+      ss.append(piece);
+    auto t2 = steady_clock::now();
+    int total = 0;
+    for (int i = 0; i < ops; ++i) {
+      String c = p + p + p + p;
+      total += c.size();
+    }
+    auto t3 = steady_clock::now();
+    for (int i = 0; i < ops; ++i) {
+      string c = piece + piece + piece + piece;
+      total -= c.size();
+    }
+    auto t4 = steady_clock::now();
+    if (s.size() != int(ss.size()) || total != 0)
+      throw logic_error("String::bench: length mismatch");
+
+    cout << len << '\t' << ns_per_op(t0, t1, ops) << '\t'
+         << ns_per_op(t1, t2, ops) << '\t' << ns_per_op(t2, t3, ops) << '\t'
+         << ns_per_op(t3, t4, ops) << endl;
+  }
   cout << endl;
 }
 } // namespace StringClass
@@ -602,15 +1126,23 @@ void test() {
 }
 } // namespace Friends
 
-int main() {
+// With a file argument, also benchmarks word counting over that file:
+//   ./a.out big.txt
+int main(int argc, char *argv[]) {
   try {
     Subscripting::test();
+    WordCount::test();
+    if (argc > 1)
+      WordCount::bench(argv[1]);
     FunctionCall::test();
     Dereferencing::test();
     IncrementDecrement::test();
     AllocationDeallocation::test();
+    AllocationDeallocation::test_size_classes();
+    // AllocationDeallocation::bench();
     UserDefinedLiterals::test();
     StringClass::test();
+    // StringClass::bench();
     Friends::test();
   } catch (const exception &e) {
     cerr << "Error: " << e.what() << endl;
@@ -0,0 +1,248 @@
+// Size-class slab allocator for small objects, and a CRTP mixin that gives a
+// class its own operator new/delete backed by it:
+//
+//   class Employee : public SlabAllocated<Employee> { ... };
+//
+// Requests are rounded up to one of a few size classes. Every thread keeps a
+// free list per class and only visits the shared (locked) list of that class
+// once per batch of objects. Objects bigger than max_size, and arrays, still
+// go to the global heap.
+//
+// Define SLAB_POOL_CHECKS before including this header to get owner() and
+// is_free(), which look inside the pool for tests.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace Slab {
+constexpr size_t slab_size = 64 * 1024; // carved into objects of one class
+constexpr size_t batch = 32; // objects moved between thread and central list
+constexpr size_t num_classes = 10;
+constexpr size_t class_sizes[num_classes] = {8,  16, 24,  32,  48,
+                                             64, 96, 128, 192, 256};
+constexpr size_t max_size = 256;
+
+// Index into class_sizes for (n + 7) / 8. An object's alignment divides its
+// size, so every class keeps the objects it holds aligned.
+constexpr uint8_t class_of[max_size / 8 + 1] = {
+    0, 0, 1, 2, 3, 4, 4, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7,
+    8, 8, 8, 8, 8, 8, 8, 8, 9, 9, 9, 9, 9, 9, 9, 9};
+
+struct FreeObject {
+  FreeObject *next;
+};
+
+struct Stats {
+  size_t slab_bytes;        // reserved from the heap
+  size_t outstanding_bytes; // live objects plus objects cached by threads
+};
+
+// The shared free list of one size class.
+class Central {
+public:
+  // Pops n objects (carving a new slab if needed) and returns them as a chain.
+  FreeObject *take(size_t object_size, size_t n) {
+    std::lock_guard<std::mutex> lock{m};
+    while (count < n)
+      carve(object_size);
+    FreeObject *head = free, *last = free;
+    for (size_t i = 1; i < n; ++i)
+      last = last->next;
+    free = last->next;
+    last->next = nullptr;
+    count -= n;
+    handed_out += n;
+    return head;
+  }
+
+  void give(FreeObject *head, FreeObject *tail, size_t n) {
+    std::lock_guard<std::mutex> lock{m};
+    tail->next = free;
+    free = head;
+    count += n;
+    handed_out -= n;
+  }
+
+  void add_stats(Stats &s, size_t object_size) {
+    std::lock_guard<std::mutex> lock{m};
+    s.slab_bytes += slabs.size() * slab_size;
+    s.outstanding_bytes += handed_out * object_size;
+  }
+
+#ifdef SLAB_POOL_CHECKS
+  // Does p lie in one of this class's slabs / on its free list?
+  bool owns(const void *p) {
+    std::lock_guard<std::mutex> lock{m};
+    for (char *slab : slabs)
+      if (std::less_equal<const void *>{}(slab, p) &&
+          std::less<const void *>{}(p, slab + slab_size))
+        return true;
+    return false;
+  }
+  bool holds(const void *p) {
+    std::lock_guard<std::mutex> lock{m};
+    for (FreeObject *o = free; o; o = o->next)
+      if (o == p)
+        return true;
+    return false;
+  }
+#endif
+
+private:
+  void carve(size_t object_size) {
+    char *slab = static_cast<char *>(::operator new(slab_size));
+    slabs.push_back(slab);
+    for (size_t off = 0; off + object_size <= slab_size; off += object_size) {
+      auto *o = reinterpret_cast<FreeObject *>(slab + off);
+      o->next = free;
+      free = o;
+      ++count;
+    }
+  }
+
+  std::mutex m;
+  FreeObject *free = nullptr;
+  size_t count = 0;
+  std::vector<char *> slabs;
+  size_t handed_out = 0;
+};
+
+// Never destroyed: objects may still be deleted during static destruction.
+inline Central *central() {
+  static Central *c = new Central[num_classes];
+  return c;
+}
+
+inline thread_local bool cache_gone = false;
+
+class ThreadCache {
+  struct List {
+    FreeObject *head = nullptr;
+    size_t count = 0;
+  };
+  List lists[num_classes];
+
+public:
+  void *allocate(size_t cls) {
+    List &l = lists[cls];
+    if (!l.head) {
+      l.head = central()[cls].take(class_sizes[cls], batch);
+      l.count = batch;
+    }
+    FreeObject *o = l.head;
+    l.head = o->next;
+    --l.count;
+    return o;
+  }
+
+  void deallocate(void *p, size_t cls) {
+    List &l = lists[cls];
+    auto *o = static_cast<FreeObject *>(p);
+    o->next = l.head;
+    l.head = o;
+    if (++l.count >= 2 * batch)
+      flush(cls, batch);
+  }
+
+#ifdef SLAB_POOL_CHECKS
+  bool holds(const void *p, size_t cls) const {
+    for (FreeObject *o = lists[cls].head; o; o = o->next)
+      if (o == p)
+        return true;
+    return false;
+  }
+#endif
+
+  ~ThreadCache() {
+    for (size_t cls = 0; cls < num_classes; ++cls)
+      flush(cls, lists[cls].count);
+    cache_gone = true;
+  }
+
+private:
+  // Hands the first n cached objects of class cls back to the central list.
+  void flush(size_t cls, size_t n) {
+    List &l = lists[cls];
+    if (n == 0)
+      return;
+    FreeObject *head = l.head, *tail = l.head;
+    for (size_t i = 1; i < n; ++i)
+      tail = tail->next;
+    l.head = tail->next;
+    l.count -= n;
+    central()[cls].give(head, tail, n);
+  }
+};
+
+inline ThreadCache &cache() {
+  thread_local ThreadCache c;
+  return c;
+}
+
+// Index into class_sizes for an n-byte object; num_classes if n goes to the
+// global heap.
+inline size_t size_class(size_t n) {
+  return n > max_size ? num_classes : class_of[(n + 7) / 8];
+}
+
+inline void *allocate(size_t n) {
+  if (n > max_size)
+    return ::operator new(n);
+  size_t cls = size_class(n);
+  if (cache_gone) // thread is exiting: no cache any more
+    return central()[cls].take(class_sizes[cls], 1);
+  return cache().allocate(cls);
+}
+
+inline void deallocate(void *p, size_t n) {
+  if (!p)
+    return;
+  if (n > max_size)
+    return ::operator delete(p);
+  size_t cls = size_class(n);
+  if (cache_gone) {
+    auto *o = static_cast<FreeObject *>(p);
+    return central()[cls].give(o, o, 1);
+  }
+  cache().deallocate(p, cls);
+}
+
+#ifdef SLAB_POOL_CHECKS
+// Class whose slabs contain p, or num_classes if p came from the global heap.
+// Scans every slab; meant for tests, not for the allocation path.
+inline size_t owner(const void *p) {
+  for (size_t cls = 0; cls < num_classes; ++cls)
+    if (central()[cls].owns(p))
+      return cls;
+  return num_classes;
+}
+
+// Is p free in class cls, i.e. cached by this thread or on the shared list?
+inline bool is_free(const void *p, size_t cls) {
+  return (!cache_gone && cache().holds(p, cls)) || central()[cls].holds(p);
+}
+#endif
+
+inline Stats stats() {
+  Stats s{};
+  for (size_t cls = 0; cls < num_classes; ++cls)
+    central()[cls].add_stats(s, class_sizes[cls]);
+  return s;
+}
+} // namespace Slab
+
+// Derive from SlabAllocated<X> to allocate X (and classes derived from it)
+// from the slab pools. Deleting through a base pointer needs a virtual
+// destructor, so that the size passed to operator delete is the real one.
+template <class Derived> struct SlabAllocated {
+  static void *operator new(size_t n) {
+    static_assert(alignof(Derived) <= 16, "slab objects are at most 16-byte aligned");
+    return Slab::allocate(n);
+  }
+  static void operator delete(void *p, size_t n) { Slab::deallocate(p, n); }
+};
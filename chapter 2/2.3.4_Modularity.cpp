@@ -1,16 +1,97 @@
 #include "Vector.h"
+#include "VectorKernels.h"
 #include <cmath>
 #include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 using namespace std;
 
-double sqareroot_sum(Vector &v) {
-  double sum = 0;
+// Both loops run through the kernel layer, which uses the widest SIMD
+// instructions available on the machine the program runs on.
+double read_and_sum(Vector &v, istream &in) {
   for (int i = 0; i < v.size(); ++i) {
-    sum += sqrt(v[i]);
+    in >> v[i];
   }
-  return sum;
+  return Kernels::sum(v.data(), v.size());
+}
+double sqareroot_sum(Vector &v) {
+  return Kernels::sqrt_sum(v.data(), v.size());
 }
+
+// Runs every kernel on every ISA this CPU supports and compares it with the
+// scalar version, for lengths that leave every possible tail after the SIMD
+// loop. Element-wise kernels (fma included: it rounds once everywhere) must
+// match bit for bit; reductions add in a different order, so they only have
+// to agree to a few ulps.
+void check_kernels() {
+  const int max_n = 67; // > 8 * 8, so every tail of every width occurs
+  Vector a(max_n), b(max_n), c(max_n), want(max_n), got(max_n);
+  for (int i = 0; i < max_n; ++i) {
+    a[i] = 0.1 * i + 1.0 / 3;
+    b[i] = 3.3 / (i + 1);
+    double product = a[i] * b[i];
+    c[i] = -product; // fused a*b+c is the product's rounding error, unfused 0
+  }
+  auto fail = [](const char *kernel, Kernels::Isa isa, int n) {
+    throw runtime_error(string(kernel) + " differs from scalar on " +
+                        Kernels::name(isa) + " for n = " + to_string(n));
+  };
+  auto close = [](double x, double y) {
+    return fabs(x - y) <= 1e-12 * (fabs(x) + fabs(y));
+  };
+  using Element = void (*)(const double *, const double *, double *, int);
+  const Kernels::Isa saved = Kernels::active();
+  const Kernels::Isa widest = Kernels::select(Kernels::Isa::avx512);
+  for (int k = 1; k <= static_cast<int>(widest); ++k) {
+    const Kernels::Isa isa = static_cast<Kernels::Isa>(k);
+    for (int n = 0; n <= max_n; ++n) {
+      for (auto [kernel, f] : {pair<const char *, Element>{"add", Kernels::add},
+                               {"mul", Kernels::mul}}) {
+        Kernels::select(Kernels::Isa::scalar);
+        f(a.data(), b.data(), want.data(), n);
+        Kernels::select(isa);
+        f(a.data(), b.data(), got.data(), n);
+        for (int i = 0; i < n; ++i)
+          if (got[i] != want[i])
+            fail(kernel, isa, n);
+      }
+      Kernels::select(Kernels::Isa::scalar);
+      Kernels::fma(a.data(), b.data(), c.data(), want.data(), n);
+      Kernels::select(isa);
+      Kernels::fma(a.data(), b.data(), c.data(), got.data(), n);
+      for (int i = 0; i < n; ++i)
+        if (got[i] != want[i])
+          fail("fma", isa, n);
+
+      Kernels::select(Kernels::Isa::scalar);
+      Kernels::scale(a.data(), 1.7, want.data(), n);
+      double dot = Kernels::dot(a.data(), b.data(), n);
+      double sum = Kernels::sum(a.data(), n);
+      double sqrt_sum = Kernels::sqrt_sum(a.data(), n);
+      Kernels::select(isa);
+      Kernels::scale(a.data(), 1.7, got.data(), n);
+      for (int i = 0; i < n; ++i)
+        if (got[i] != want[i])
+          fail("scale", isa, n);
+      if (!close(Kernels::dot(a.data(), b.data(), n), dot))
+        fail("dot", isa, n);
+      if (!close(Kernels::sum(a.data(), n), sum))
+        fail("sum", isa, n);
+      if (!close(Kernels::sqrt_sum(a.data(), n), sqrt_sum))
+        fail("sqrt_sum", isa, n);
+    }
+  }
+  Kernels::select(saved);
+  cout << "kernels match scalar on every ISA up to " << Kernels::name(widest)
+       << "\n";
+}
+
 int main() {
   Vector v(5);
+  istringstream input{"1 2 3 4 5"};
+  cout << "kernels: " << Kernels::name(Kernels::active()) << "\n";
+  cout << read_and_sum(v, input) << "\n";
   cout << sqareroot_sum(v) << "\n";
+  check_kernels();
 }
@@ -3,4 +3,5 @@
 Vector::Vector(int size) : _size{size}, _elements{new double[size]} {}
 double &Vector::operator[](int i) { return _elements[i]; }
 int Vector::size() { return _size; }
+double *Vector::data() { return _elements; }
 Vector::~Vector() { delete[] _elements; }
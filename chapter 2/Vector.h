@@ -3,6 +3,7 @@ public:
   Vector(int size);
   double &operator[](int index);
   int size();
+  double *data(); // contiguous elements, for the kernels in VectorKernels.h
   ~Vector();
 
 private:
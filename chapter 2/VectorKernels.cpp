@@ -0,0 +1,339 @@
+#include "VectorKernels.h"
+#include <atomic>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define KERNELS_X86 1
+#endif
+
+namespace Kernels {
+namespace {
+
+// Scalar reference versions, also used for the tails of the SIMD loops.
+// fma rounds once (std::fma) like the FMA instructions, so its results do not
+// depend on the ISA. SSE2 has no fused multiply-add and uses this version.
+void add_scalar(const double *a, const double *b, double *out, int n) {
+  for (int i = 0; i < n; ++i)
+    out[i] = a[i] + b[i];
+}
+void mul_scalar(const double *a, const double *b, double *out, int n) {
+  for (int i = 0; i < n; ++i)
+    out[i] = a[i] * b[i];
+}
+void fma_scalar(const double *a, const double *b, const double *c, double *out,
+                int n) {
+  for (int i = 0; i < n; ++i)
+    out[i] = std::fma(a[i], b[i], c[i]);
+}
+void scale_scalar(const double *a, double s, double *out, int n) {
+  for (int i = 0; i < n; ++i)
+    out[i] = s * a[i];
+}
+double dot_scalar(const double *a, const double *b, int n) {
+  double acc = 0;
+  for (int i = 0; i < n; ++i)
+    acc += a[i] * b[i];
+  return acc;
+}
+double sum_scalar(const double *a, int n) {
+  double acc = 0;
+  for (int i = 0; i < n; ++i)
+    acc += a[i];
+  return acc;
+}
+double sqrt_sum_scalar(const double *a, int n) {
+  double acc = 0;
+  for (int i = 0; i < n; ++i)
+    acc += std::sqrt(a[i]);
+  return acc;
+}
+
+#ifdef KERNELS_X86
+// SSE2: 2 doubles per register, baseline on every x86-64 CPU.
+__attribute__((target("sse2"))) double hsum(__m128d v) {
+  return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+__attribute__((target("sse2"))) void add_sse2(const double *a, const double *b,
+                                              double *out, int n) {
+  int i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(out + i,
+                  _mm_add_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  add_scalar(a + i, b + i, out + i, n - i);
+}
+__attribute__((target("sse2"))) void mul_sse2(const double *a, const double *b,
+                                              double *out, int n) {
+  int i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(out + i,
+                  _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  mul_scalar(a + i, b + i, out + i, n - i);
+}
+__attribute__((target("sse2"))) void scale_sse2(const double *a, double s,
+                                                double *out, int n) {
+  __m128d vs = _mm_set1_pd(s);
+  int i = 0;
+  for (; i + 2 <= n; i += 2)
+    _mm_storeu_pd(out + i, _mm_mul_pd(vs, _mm_loadu_pd(a + i)));
+  scale_scalar(a + i, s, out + i, n - i);
+}
+__attribute__((target("sse2"))) double dot_sse2(const double *a,
+                                                const double *b, int n) {
+  __m128d acc = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 2 <= n; i += 2)
+    acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+  return hsum(acc) + dot_scalar(a + i, b + i, n - i);
+}
+__attribute__((target("sse2"))) double sum_sse2(const double *a, int n) {
+  __m128d acc = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 2 <= n; i += 2)
+    acc = _mm_add_pd(acc, _mm_loadu_pd(a + i));
+  return hsum(acc) + sum_scalar(a + i, n - i);
+}
+__attribute__((target("sse2"))) double sqrt_sum_sse2(const double *a, int n) {
+  __m128d acc = _mm_setzero_pd();
+  int i = 0;
+  for (; i + 2 <= n; i += 2)
+    acc = _mm_add_pd(acc, _mm_sqrt_pd(_mm_loadu_pd(a + i)));
+  return hsum(acc) + sqrt_sum_scalar(a + i, n - i);
+}
+
+// AVX2 + FMA: 4 doubles per register.
+__attribute__((target("avx2,fma"))) double hsum(__m256d v) {
+  __m128d lo = _mm256_castpd256_pd128(v);
+  __m128d hi = _mm256_extractf128_pd(v, 1);
+  lo = _mm_add_pd(lo, hi);
+  return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+__attribute__((target("avx2,fma"))) void add_avx2(const double *a,
+                                                  const double *b, double *out,
+                                                  int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(a + i),
+                                            _mm256_loadu_pd(b + i)));
+  add_scalar(a + i, b + i, out + i, n - i);
+}
+__attribute__((target("avx2,fma"))) void mul_avx2(const double *a,
+                                                  const double *b, double *out,
+                                                  int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(a + i),
+                                            _mm256_loadu_pd(b + i)));
+  mul_scalar(a + i, b + i, out + i, n - i);
+}
+__attribute__((target("avx2,fma"))) void
+fma_avx2(const double *a, const double *b, const double *c, double *out,
+         int n) {
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_fmadd_pd(_mm256_loadu_pd(a + i),
+                                              _mm256_loadu_pd(b + i),
+                                              _mm256_loadu_pd(c + i)));
+  fma_scalar(a + i, b + i, c + i, out + i, n - i);
+}
+__attribute__((target("avx2,fma"))) void scale_avx2(const double *a, double s,
+                                                    double *out, int n) {
+  __m256d vs = _mm256_set1_pd(s);
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    _mm256_storeu_pd(out + i, _mm256_mul_pd(vs, _mm256_loadu_pd(a + i)));
+  scale_scalar(a + i, s, out + i, n - i);
+}
+__attribute__((target("avx2,fma"))) double dot_avx2(const double *a,
+                                                    const double *b, int n) {
+  __m256d acc = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm256_fmadd_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i), acc);
+  return hsum(acc) + dot_scalar(a + i, b + i, n - i);
+}
+__attribute__((target("avx2,fma"))) double sum_avx2(const double *a, int n) {
+  __m256d acc = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm256_add_pd(acc, _mm256_loadu_pd(a + i));
+  return hsum(acc) + sum_scalar(a + i, n - i);
+}
+__attribute__((target("avx2,fma"))) double sqrt_sum_avx2(const double *a,
+                                                         int n) {
+  __m256d acc = _mm256_setzero_pd();
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+    acc = _mm256_add_pd(acc, _mm256_sqrt_pd(_mm256_loadu_pd(a + i)));
+  return hsum(acc) + sqrt_sum_scalar(a + i, n - i);
+}
+
+// AVX-512F: 8 doubles per register. GCC's _mm512_reduce_add_pd starts from
+// an intentionally undefined register, which -Wall reports as uninitialized.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+__attribute__((target("avx512f"))) void add_avx512(const double *a,
+                                                   const double *b,
+                                                   double *out, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(out + i, _mm512_add_pd(_mm512_loadu_pd(a + i),
+                                            _mm512_loadu_pd(b + i)));
+  add_scalar(a + i, b + i, out + i, n - i);
+}
+__attribute__((target("avx512f"))) void mul_avx512(const double *a,
+                                                   const double *b,
+                                                   double *out, int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(out + i, _mm512_mul_pd(_mm512_loadu_pd(a + i),
+                                            _mm512_loadu_pd(b + i)));
+  mul_scalar(a + i, b + i, out + i, n - i);
+}
+__attribute__((target("avx512f"))) void
+fma_avx512(const double *a, const double *b, const double *c, double *out,
+           int n) {
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(out + i, _mm512_fmadd_pd(_mm512_loadu_pd(a + i),
+                                              _mm512_loadu_pd(b + i),
+                                              _mm512_loadu_pd(c + i)));
+  fma_scalar(a + i, b + i, c + i, out + i, n - i);
+}
+__attribute__((target("avx512f"))) void scale_avx512(const double *a, double s,
+                                                     double *out, int n) {
+  __m512d vs = _mm512_set1_pd(s);
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm512_storeu_pd(out + i, _mm512_mul_pd(vs, _mm512_loadu_pd(a + i)));
+  scale_scalar(a + i, s, out + i, n - i);
+}
+__attribute__((target("avx512f"))) double dot_avx512(const double *a,
+                                                     const double *b, int n) {
+  __m512d acc = _mm512_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm512_fmadd_pd(_mm512_loadu_pd(a + i), _mm512_loadu_pd(b + i), acc);
+  return _mm512_reduce_add_pd(acc) + dot_scalar(a + i, b + i, n - i);
+}
+__attribute__((target("avx512f"))) double sum_avx512(const double *a, int n) {
+  __m512d acc = _mm512_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm512_add_pd(acc, _mm512_loadu_pd(a + i));
+  return _mm512_reduce_add_pd(acc) + sum_scalar(a + i, n - i);
+}
+__attribute__((target("avx512f"))) double sqrt_sum_avx512(const double *a,
+                                                          int n) {
+  __m512d acc = _mm512_setzero_pd();
+  int i = 0;
+  for (; i + 8 <= n; i += 8)
+    acc = _mm512_add_pd(acc, _mm512_sqrt_pd(_mm512_loadu_pd(a + i)));
+  return _mm512_reduce_add_pd(acc) + sqrt_sum_scalar(a + i, n - i);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif // KERNELS_X86
+
+// One function pointer per kernel; swapped as a whole when the ISA changes.
+struct Table {
+  Isa isa;
+  void (*add)(const double *, const double *, double *, int);
+  void (*mul)(const double *, const double *, double *, int);
+  void (*fma)(const double *, const double *, const double *, double *, int);
+  void (*scale)(const double *, double, double *, int);
+  double (*dot)(const double *, const double *, int);
+  double (*sum)(const double *, int);
+  double (*sqrt_sum)(const double *, int);
+};
+
+const Table tables[] = {
+    {Isa::scalar, add_scalar, mul_scalar, fma_scalar, scale_scalar, dot_scalar,
+     sum_scalar, sqrt_sum_scalar},
+#ifdef KERNELS_X86
+    {Isa::sse2, add_sse2, mul_sse2, fma_scalar, scale_sse2, dot_sse2, sum_sse2,
+     sqrt_sum_sse2},
+    {Isa::avx2, add_avx2, mul_avx2, fma_avx2, scale_avx2, dot_avx2, sum_avx2,
+     sqrt_sum_avx2},
+    {Isa::avx512, add_avx512, mul_avx512, fma_avx512, scale_avx512, dot_avx512,
+     sum_avx512, sqrt_sum_avx512},
+#endif
+};
+
+// Widest ISA this CPU supports. __builtin_cpu_supports also checks that the
+// OS saves the wide registers (XGETBV), so a positive answer is safe to use.
+Isa detect() {
+#ifdef KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return Isa::avx512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return Isa::avx2;
+  if (__builtin_cpu_supports("sse2"))
+    return Isa::sse2;
+#endif
+  return Isa::scalar;
+}
+
+// Function-local statics, so the CPU is queried on the first kernel call even
+// when that happens during another translation unit's static initialization.
+// The table pointer is atomic because select() may run while other threads
+// are calling kernels.
+Isa best() {
+  static const Isa isa = detect();
+  return isa;
+}
+std::atomic<const Table *> &table() {
+  static std::atomic<const Table *> t{&tables[static_cast<int>(best())]};
+  return t;
+}
+const Table *current() { return table().load(std::memory_order_acquire); }
+
+} // namespace
+
+Isa active() { return current()->isa; }
+
+Isa select(Isa wanted) {
+  if (static_cast<int>(wanted) > static_cast<int>(best()))
+    wanted = best();
+  table().store(&tables[static_cast<int>(wanted)], std::memory_order_release);
+  return wanted;
+}
+
+const char *name(Isa isa) {
+  switch (isa) {
+  case Isa::scalar:
+    return "scalar";
+  case Isa::sse2:
+    return "sse2";
+  case Isa::avx2:
+    return "avx2";
+  case Isa::avx512:
+    return "avx512";
+  }
+  return "unknown";
+}
+
+void add(const double *a, const double *b, double *out, int n) {
+  current()->add(a, b, out, n);
+}
+void mul(const double *a, const double *b, double *out, int n) {
+  current()->mul(a, b, out, n);
+}
+void fma(const double *a, const double *b, const double *c, double *out,
+         int n) {
+  current()->fma(a, b, c, out, n);
+}
+void scale(const double *a, double s, double *out, int n) {
+  current()->scale(a, s, out, n);
+}
+double dot(const double *a, const double *b, int n) {
+  return current()->dot(a, b, n);
+}
+double sum(const double *a, int n) { return current()->sum(a, n); }
+double sqrt_sum(const double *a, int n) { return current()->sqrt_sum(a, n); }
+} // namespace Kernels
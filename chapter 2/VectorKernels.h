@@ -0,0 +1,26 @@
+// Element-wise and reduction kernels over contiguous doubles.
+// One binary carries scalar, SSE2, AVX2 and AVX-512 versions of every kernel;
+// the widest one the CPU (and OS) supports is picked on first use via CPUID.
+//
+// g++ -std=c++17 -O2 2.3.4_Modularity.cpp Vector.cpp VectorKernels.cpp
+namespace Kernels {
+enum class Isa { scalar, sse2, avx2, avx512 };
+
+Isa active();           // the ISA every kernel below dispatches to
+Isa select(Isa wanted); // force a narrower ISA (e.g. for benchmarks)
+const char *name(Isa isa);
+
+void add(const double *a, const double *b, double *out, int n); // a + b
+void mul(const double *a, const double *b, double *out, int n); // a * b
+// a * b + c with a single rounding on every ISA (std::fma without FMA
+// hardware, so the scalar and SSE2 versions are slower than a separate * and +).
+void fma(const double *a, const double *b, const double *c, double *out,
+         int n);
+void scale(const double *a, double s, double *out, int n); // s * a
+
+// Reductions. Wider ISAs add in a different order, so results may differ from
+// the scalar version in the last bits.
+double dot(const double *a, const double *b, int n);
+double sum(const double *a, int n);
+double sqrt_sum(const double *a, int n);
+} // namespace Kernels
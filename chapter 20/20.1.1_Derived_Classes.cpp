@@ -10,6 +10,9 @@
  * 20.7 Advice
  */
 
+#include <chrono>
+#include <cstddef>
+#include <forward_list>
 #include <iostream>
 #include <list>
 #include <map>
@@ -226,24 +229,254 @@ void test() {
 // 20.5 Access Control
 // ==============================================================================
 namespace AccessControl {
+// A singly linked list (with a tail pointer, so it also serves as a queue)
+// whose Links are allocated chunk_size at a time. Erased Links go on the free
+// list and are reused; chunks are only returned when the List is destroyed.
 template <class T> class List {
+  struct Link;
+
 public:
-  void insert(T val) { /* ... */ }
+  class iterator {
+  public:
+    using iterator_category = forward_iterator_tag;
+    using value_type = T;
+    using difference_type = ptrdiff_t;
+    using pointer = T *;
+    using reference = T &;
+
+    iterator(Link *l = nullptr) : p{l} {}
+    T &operator*() const { return p->val; }
+    T *operator->() const { return &p->val; }
+    iterator &operator++() {
+      p = p->next;
+      return *this;
+    }
+    iterator operator++(int) {
+      iterator old = *this;
+      p = p->next;
+      return old;
+    }
+    bool operator==(iterator b) const { return p == b.p; }
+    bool operator!=(iterator b) const { return p != b.p; }
+
+  private:
+    Link *p;
+    friend class List;
+  };
+
+  List() = default;
+  List(const List &) = delete;
+  List &operator=(const List &) = delete;
+  List(List &&a) noexcept { swap(a); }
+  List &operator=(List &&a) noexcept {
+    List tmp{std::move(a)};
+    swap(tmp);
+    return *this;
+  }
+  ~List() {
+    clear();
+    while (allocated) {
+      Chunk *c = allocated;
+      allocated = c->next;
+      delete c;
+    }
+  }
+
+  void insert(T val) { push_front(std::move(val)); } // at the head
+
+  void push_front(T val) {
+    Link *l = get(std::move(val));
+    l->next = head;
+    head = l;
+    if (!tail)
+      tail = l;
+  }
+  void push_back(T val) {
+    Link *l = get(std::move(val));
+    if (tail)
+      tail->next = l;
+    else
+      head = l;
+    tail = l;
+  }
+  void pop_front() { erase_front(); }
+
+  // Inserts val after pos and returns an iterator to it.
+  iterator insert_after(iterator pos, T val) {
+    Link *l = get(std::move(val));
+    l->next = pos.p->next;
+    pos.p->next = l;
+    if (tail == pos.p)
+      tail = l;
+    return l;
+  }
+  // Erases the element after pos and returns an iterator to the next one.
+  iterator erase_after(iterator pos) {
+    Link *l = pos.p->next;
+    pos.p->next = l->next;
+    if (tail == l)
+      tail = pos.p;
+    put(l);
+    return pos.p->next;
+  }
+
+  // Moves all elements of a to the end of this list without copying them.
+  // The Links stay where they are, so their chunks (and a's free Links) are
+  // adopted too.
+  void splice(List &a) {
+    if (&a == this)
+      return;
+    if (a.head) {
+      if (tail)
+        tail->next = a.head;
+      else
+        head = a.head;
+      tail = a.tail;
+      n += a.n;
+    }
+    if (a.allocated) {
+      Chunk *c = a.allocated;
+      while (c->next)
+        c = c->next;
+      c->next = allocated;
+      allocated = a.allocated;
+    }
+    while (Link *l = a.free) {
+      a.free = l->next;
+      l->next = free;
+      free = l;
+    }
+    a.head = a.tail = nullptr;
+    a.allocated = nullptr;
+    a.n = 0;
+  }
+
+  void clear() {
+    while (head)
+      erase_front();
+  }
+
+  iterator begin() { return head; }
+  iterator end() { return nullptr; }
+  T &front() { return head->val; }
+  T &back() { return tail->val; }
+  bool empty() const { return head == nullptr; }
+  size_t size() const { return n; }
+
+  void swap(List &a) noexcept {
+    std::swap(head, a.head);
+    std::swap(tail, a.tail);
+    std::swap(n, a.n);
+    std::swap(allocated, a.allocated);
+    std::swap(free, a.free);
+  }
 
 private:
   struct Link {
-    T val;
     Link *next;
+    union {
+      T val; // constructed only while the Link is in the list
+    };
+    Link() {}
+    ~Link() {}
   };
   struct Chunk {
     enum { chunk_size = 15 };
     Link v[chunk_size];
     Chunk *next;
   };
-  Chunk *allocated;
-  Link *free;
+
+  Link *get(T &&val) {
+    if (!free)
+      grow();
+    Link *l = free;
+    new (&l->val) T(std::move(val));
+    free = l->next;
+    l->next = nullptr;
+    ++n;
+    return l;
+  }
+  void put(Link *l) {
+    l->val.~T();
+    l->next = free;
+    free = l;
+    --n;
+  }
+  void grow() {
+    Chunk *c = new Chunk;
+    c->next = allocated;
+    allocated = c;
+    for (int i = 0; i < Chunk::chunk_size; ++i) {
+      c->v[i].next = free;
+      free = &c->v[i];
+    }
+  }
+  void erase_front() {
+    Link *l = head;
+    head = l->next;
+    if (!head)
+      tail = nullptr;
+    put(l);
+  }
+
+  Link *head = nullptr;
+  Link *tail = nullptr;
+  size_t n = 0;
+  Chunk *allocated = nullptr;
+  Link *free = nullptr;
 };
 
+// Many short queues: every step pushes onto one queue and pops from
+// another, so links are constantly freed and reused.
+template <class Queue, class Push, class Pop>
+double churn(int queues, int steps, Push push, Pop pop) {
+  vector<Queue> qs(queues);
+  unsigned seed = 1;
+  long sum = 0;
+  auto start = chrono::steady_clock::now();
+  for (int i = 0; i < steps; ++i) {
+    seed = seed * 1103515245 + 12345;
+    Queue &in = qs[(seed >> 8) % queues];
+    Queue &out = qs[(seed >> 20) % queues];
+    push(in, i);
+    if (!out.empty())
+      sum += pop(out);
+  }
+  double ms = chrono::duration<double, milli>(chrono::steady_clock::now() -
+                                              start)
+                  .count();
+  return sum == -1 ? 0 : ms; // keep sum alive
+}
+
+void bench(int queues = 1000, int steps = 10000000) {
+  double chunked = churn<List<int>>(
+      queues, steps, [](List<int> &q, int v) { q.push_back(v); },
+      [](List<int> &q) {
+        int v = q.front();
+        q.pop_front();
+        return v;
+      });
+  double std_list = churn<list<int>>(
+      queues, steps, [](list<int> &q, int v) { q.push_back(v); },
+      [](list<int> &q) {
+        int v = q.front();
+        q.pop_front();
+        return v;
+      });
+  // forward_list has no push_back; push at the front and pop at the front
+  // (LIFO), which is its cheapest insert/erase pair.
+  double std_forward = churn<forward_list<int>>(
+      queues, steps, [](forward_list<int> &q, int v) { q.push_front(v); },
+      [](forward_list<int> &q) {
+        int v = q.front();
+        q.pop_front();
+        return v;
+      });
+  cout << queues << " queues, " << steps << " push+pop: List " << chunked
+       << " ms, std::list " << std_list << " ms, std::forward_list "
+       << std_forward << " ms" << endl;
+}
+
 class Buffer {
 protected:
   char a[128];
@@ -272,6 +505,22 @@ void test() {
   cb.set(0, 'A');
   // cb.access(0); // Error: protected
   cout << "Access control logic verified." << endl;
+
+  List<string> q;
+  for (int i = 0; i < 20; ++i)
+    q.push_back("job" + to_string(i));
+  for (int i = 0; i < 18; ++i)
+    q.pop_front();
+  q.insert("urgent");
+  q.insert_after(q.begin(), "next");
+  List<string> more;
+  more.push_back("late");
+  q.splice(more);
+  q.erase_after(q.begin());
+  cout << "List (" << q.size() << "):";
+  for (const string &s : q)
+    cout << ' ' << s;
+  cout << endl;
   cout << endl;
 }
 } // namespace AccessControl
@@ -339,6 +588,7 @@ int main() {
     Relaxation::test();
     AbstractClasses::test();
     AccessControl::test();
+    // AccessControl::bench();
     PointersToMembers::test();
   } catch (const exception &e) {
     cerr << "Error: " << e.what() << endl;
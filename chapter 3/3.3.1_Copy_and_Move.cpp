@@ -12,6 +12,16 @@
   * Move constructor: Called when an object is initialized with another object
   * Move assignment operator: Called when an object is assigned another object
 
+  Capacity
+  * size() is the number of elements, capacity() the number of allocated slots
+  * Growing geometrically (x2) makes push_back amortized O(1)
+  * Relocation of trivially copyable elements is a plain memcpy
+
+  Expression Templates
+  * x + y + z returns a description of the computation, not a Vector
+  * Assigning it to a Vector evaluates all operations in one loop, so a chain
+  of k operations allocates nothing and touches each element once
+
   Resource Management
   * RAII: Resource Acquisition Is Initialization
   * Use smart pointers to manage resources
@@ -25,8 +35,16 @@
   * A Class that uses a non-copyable resource
 
 */
+#include <chrono>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <new>
 #include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace complexNumber {
 class complex {
@@ -109,67 +127,104 @@ void test(complex z1) {
 
 namespace Container {
 
-class Vector {
+// Moves n objects from src into uninitialized storage at dst. Trivially
+// copyable payloads are relocated with a single memcpy, everything else is
+// move constructed (or copied if the move could throw) and then destroyed.
+template <class T> void relocate(T *src, std::size_t n, T *dst) {
+  if constexpr (std::is_trivially_copyable_v<T>) {
+    if (n)
+      std::memcpy(dst, src, n * sizeof(T));
+  } else {
+    for (std::size_t i = 0; i < n; ++i) {
+      new (dst + i) T(std::move_if_noexcept(src[i]));
+      src[i].~T();
+    }
+  }
+}
+
+// Expression templates: arithmetic on vectors builds a tree of lightweight
+// nodes instead of temporaries. Nothing is computed until the tree is assigned
+// to a Vector, which then evaluates every element in a single pass.
+template <class E> struct VecExpr {
+  const E &self() const { return static_cast<const E &>(*this); }
+  double eval(int i) const { return self().eval(i); }
+  int size() const { return self().size(); }
+};
+
+class Vector : public VecExpr<Vector> {
 private:
   int _size;
+  int _capacity;
   double *_data;
 
+  void grow(int min_capacity); // geometric growth, at least min_capacity
+
 public:
-  Vector() : _size{0}, _data{nullptr} {}
+  Vector() : _size{0}, _capacity{0}, _data{nullptr} {}
   Vector(std::initializer_list<double> list);
   Vector(int s);
-  Vector operator+(const Vector &other);
+  template <class E> Vector(const VecExpr<E> &expr);
 
   Vector(const Vector &other);            // Copy constructor
   Vector &operator=(const Vector &other); // Assignment constructor
 
   Vector(Vector &&other);            // Move constructor
   Vector &operator=(Vector &&other); // Move assignment constructor
+  template <class E> Vector &operator=(const VecExpr<E> &expr);
 
   ~Vector() { delete[] _data; }
   double &operator[](int index);
   int size() const { return _size; }
+  int capacity() const { return _capacity; }
+  double eval(int i) const { return _data[i]; } // unchecked, for expressions
+
+  void reserve(int new_capacity); // never shrinks
+  void shrink_to_fit();           // capacity == size afterwards
   void push_back(double value);
+  template <class... Args> double &emplace_back(Args &&...args);
 };
 Vector::Vector(int s) {
   if (s < 0)
     throw std::length_error("Vector constructor: negative size");
   _data = new double[s];
   _size = s;
+  _capacity = s;
 }
 Vector::Vector(const Vector &other)
-    : _size{other._size}, _data{new double[_size]} {
+    : _size{other._size}, _capacity{other._size},
+      _data{new double[_capacity]} {
   std::copy(other._data, other._data + _size, _data);
 }
 Vector &Vector::operator=(const Vector &other) {
   if (this != &other) {
-    delete[] _data;
+    if (_capacity < other._size) { // reuse the buffer when it is big enough
+      double *new_data = new double[other._size];
+      delete[] _data;
+      _data = new_data;
+      _capacity = other._size;
+    }
     _size = other._size;
-    _data = new double[_size];
     std::copy(other._data, other._data + _size, _data);
   }
   return *this;
 }
-Vector Vector::operator+(const Vector &other) {
-  Vector result(_size);
-  for (int item = 0; item < _size; item++) {
-    result[item] = _data[item] + other._data[item];
-  }
-  return result;
-}
 // && means rvalue reference which means something that appear on the right hand
 // side of an assignment or initialization
 
-Vector::Vector(Vector &&other) : _size{other._size}, _data{other._data} {
+Vector::Vector(Vector &&other)
+    : _size{other._size}, _capacity{other._capacity}, _data{other._data} {
   other._size = 0;
+  other._capacity = 0;
   other._data = nullptr;
 }
 Vector &Vector::operator=(Vector &&other) {
   if (this != &other) {
     delete[] _data;
     _size = other._size;
+    _capacity = other._capacity;
     _data = other._data;
     other._size = 0;
+    other._capacity = 0;
     other._data = nullptr;
   }
   return *this;
@@ -181,24 +236,51 @@ Vector read(std::istream &is) {
     v.push_back(d);
   return v;
 }
-Vector::Vector(std::initializer_list<double> list) {
-  Vector v = Vector(list.size());
-  std::copy(list.begin(), list.end(), v._data);
-  *this = v;
+Vector::Vector(std::initializer_list<double> list)
+    : Vector(static_cast<int>(list.size())) {
+  std::copy(list.begin(), list.end(), _data);
 }
-void Vector::push_back(
-    double value) { // double size of allocated memory and copy old data
-  if (_size == 0) {
-    _data = new double[1];
-    _size = 1;
-  } else {
-    double *new_data = new double[_size * 2];
-    std::copy(_data, _data + _size, new_data);
-    new_data[_size] = value;
-    delete[] _data;
-    _data = new_data;
-    _size++;
-  }
+
+// Amortized O(1) append: the buffer doubles when full, so n pushes perform
+// O(log n) allocations and O(n) element moves in total.
+void Vector::grow(int min_capacity) {
+  if (_capacity > std::numeric_limits<int>::max() / 2)
+    throw std::length_error("Vector::grow: capacity would overflow int");
+  int new_capacity = _capacity ? _capacity * 2 : 8;
+  if (new_capacity < min_capacity)
+    new_capacity = min_capacity;
+  reserve(new_capacity);
+}
+void Vector::reserve(int new_capacity) {
+  if (new_capacity < 0)
+    throw std::length_error("Vector::reserve: negative capacity");
+  if (new_capacity <= _capacity)
+    return;
+  double *new_data = new double[new_capacity];
+  relocate(_data, _size, new_data);
+  delete[] _data;
+  _data = new_data;
+  _capacity = new_capacity;
+}
+void Vector::shrink_to_fit() {
+  if (_size == _capacity)
+    return;
+  double *new_data = _size ? new double[_size] : nullptr;
+  relocate(_data, _size, new_data);
+  delete[] _data;
+  _data = new_data;
+  _capacity = _size;
+}
+void Vector::push_back(double value) {
+  if (_size == _capacity)
+    grow(_size + 1);
+  _data[_size++] = value;
+}
+template <class... Args> double &Vector::emplace_back(Args &&...args) {
+  if (_size == _capacity)
+    grow(_size + 1);
+  _data[_size] = double(std::forward<Args>(args)...);
+  return _data[_size++];
 }
 double &Vector::operator[](int index) {
   if (index < 0 || _size <= index)
@@ -206,6 +288,145 @@ double &Vector::operator[](int index) {
   return _data[index];
 }
 
+// Leaves: a Vector is held by reference, everything else (nodes, scalars) by
+// value, so an expression never copies vector data.
+template <class E> struct ExprOperand {
+  using type = const E;
+};
+template <> struct ExprOperand<Vector> {
+  using type = const Vector &;
+};
+
+// A scalar broadcast to every element; size() of -1 means "any size".
+struct Scalar : VecExpr<Scalar> {
+  double value;
+  explicit Scalar(double v) : value{v} {}
+  double eval(int) const { return value; }
+  int size() const { return -1; }
+};
+
+template <class Op, class L, class R>
+struct BinaryExpr : VecExpr<BinaryExpr<Op, L, R>> {
+  typename ExprOperand<L>::type l;
+  typename ExprOperand<R>::type r;
+
+  BinaryExpr(const L &left, const R &right) : l{left}, r{right} {
+    if (l.size() >= 0 && r.size() >= 0 && l.size() != r.size())
+      throw std::length_error("Vector expression: size mismatch");
+  }
+  double eval(int i) const { return Op{}(l.eval(i), r.eval(i)); }
+  int size() const { return l.size() >= 0 ? l.size() : r.size(); }
+};
+
+template <class Op, class E> struct UnaryExpr : VecExpr<UnaryExpr<Op, E>> {
+  typename ExprOperand<E>::type e;
+
+  explicit UnaryExpr(const E &operand) : e{operand} {}
+  double eval(int i) const { return Op{}(e.eval(i)); }
+  int size() const { return e.size(); }
+};
+
+template <class L, class R>
+BinaryExpr<std::plus<>, L, R> operator+(const VecExpr<L> &l,
+                                        const VecExpr<R> &r) {
+  return {l.self(), r.self()};
+}
+template <class L, class R>
+BinaryExpr<std::minus<>, L, R> operator-(const VecExpr<L> &l,
+                                         const VecExpr<R> &r) {
+  return {l.self(), r.self()};
+}
+// Element-wise product
+template <class L, class R>
+BinaryExpr<std::multiplies<>, L, R> operator*(const VecExpr<L> &l,
+                                              const VecExpr<R> &r) {
+  return {l.self(), r.self()};
+}
+template <class L, class R>
+BinaryExpr<std::divides<>, L, R> operator/(const VecExpr<L> &l,
+                                           const VecExpr<R> &r) {
+  return {l.self(), r.self()};
+}
+template <class E>
+UnaryExpr<std::negate<>, E> operator-(const VecExpr<E> &e) {
+  return UnaryExpr<std::negate<>, E>{e.self()};
+}
+
+// Scalar on either side
+template <class E> auto operator+(const VecExpr<E> &e, double d) {
+  return e + Scalar{d};
+}
+template <class E> auto operator+(double d, const VecExpr<E> &e) {
+  return Scalar{d} + e;
+}
+template <class E> auto operator-(const VecExpr<E> &e, double d) {
+  return e - Scalar{d};
+}
+template <class E> auto operator-(double d, const VecExpr<E> &e) {
+  return Scalar{d} - e;
+}
+template <class E> auto operator*(const VecExpr<E> &e, double d) {
+  return e * Scalar{d};
+}
+template <class E> auto operator*(double d, const VecExpr<E> &e) {
+  return Scalar{d} * e;
+}
+template <class E> auto operator/(const VecExpr<E> &e, double d) {
+  return e / Scalar{d};
+}
+template <class E> auto operator/(double d, const VecExpr<E> &e) {
+  return Scalar{d} / e;
+}
+
+template <class E> Vector::Vector(const VecExpr<E> &expr) : Vector() {
+  *this = expr;
+}
+// One pass, no temporaries. Each element is read and written at the same
+// index, so the destination may safely appear in the expression (z = x + z).
+template <class E> Vector &Vector::operator=(const VecExpr<E> &expr) {
+  int n = expr.size();
+  if (n < 0)
+    throw std::length_error("Vector: cannot assign a bare scalar");
+  if (_capacity < n) { // only reallocates when the destination can't be in expr
+    delete[] _data;
+    _data = new double[n];
+    _capacity = n;
+  }
+  _size = n;
+  const E &e = expr.self();
+  for (int i = 0; i < n; ++i)
+    _data[i] = e.eval(i);
+  return *this;
+}
+
+// The original operators, one temporary per operation. Kept for comparison.
+namespace Eager {
+Vector operator+(const Vector &a, const Vector &b) {
+  Vector result(a.size());
+  for (int item = 0; item < a.size(); item++)
+    result[item] = a.eval(item) + b.eval(item);
+  return result;
+}
+Vector operator-(const Vector &a, const Vector &b) {
+  Vector result(a.size());
+  for (int item = 0; item < a.size(); item++)
+    result[item] = a.eval(item) - b.eval(item);
+  return result;
+}
+Vector operator*(const Vector &a, const Vector &b) {
+  Vector result(a.size());
+  for (int item = 0; item < a.size(); item++)
+    result[item] = a.eval(item) * b.eval(item);
+  return result;
+}
+Vector operator*(double d, const Vector &a) {
+  Vector result(a.size());
+  for (int item = 0; item < a.size(); item++)
+    result[item] = d * a.eval(item);
+  return result;
+}
+} // namespace Eager
+
 // Trigger segfault because of shallow copy
 // Without proper copy and assignment the deconstructor will be called twice
 // (use after free or double free)
@@ -229,6 +450,83 @@ Vector move_test() {
   y = std::move(x);
   return z;
 }
+
+// Appends 10^3 .. 10^max_exponent doubles to Container::Vector and std::vector
+// and prints the cost per element. With geometric growth both should stay flat
+// as n increases; the old grow-by-copy push_back was quadratic.
+void bench_push_back(int max_exponent = 8) {
+  using namespace std::chrono;
+  std::cout << "n\tVector ns/elem\tstd::vector ns/elem" << std::endl;
+  for (int exponent = 3; exponent <= max_exponent; ++exponent) {
+    int n = 1;
+    for (int i = 0; i < exponent; ++i)
+      n *= 10;
+
+    auto start = steady_clock::now();
+    {
+      Vector v;
+      for (int i = 0; i < n; ++i)
+        v.push_back(i);
+      if (v.size() != n)
+        throw std::logic_error("bench_push_back: wrong size");
+    }
+    auto mid = steady_clock::now();
+    {
+      std::vector<double> v;
+      for (int i = 0; i < n; ++i)
+        v.push_back(i);
+      if (static_cast<int>(v.size()) != n)
+        throw std::logic_error("bench_push_back: wrong size");
+    }
+    auto end = steady_clock::now();
+
+    std::cout << n << "\t" << duration<double, std::nano>(mid - start).count() / n
+              << "\t" << duration<double, std::nano>(end - mid).count() / n
+              << std::endl;
+  }
+}
+// r = a + b * c - 2.0 * d + e * f - g: six binary operations over seven inputs.
+// Eager: every operation streams its two operands and writes a fresh temporary
+// (2 reads + 1 write, scalar ops 1 + 1), i.e. 16 passes over n doubles and six
+// allocations. Fused: 7 reads + 1 write and no allocation beyond the result.
+void bench_expression(int n = 1000000, int repeats = 20) {
+  using namespace std::chrono;
+  Vector a(n), b(n), c(n), d(n), e(n), f(n), g(n);
+  for (int i = 0; i < n; ++i) {
+    a[i] = i;
+    b[i] = i * 0.5;
+    c[i] = 3;
+    d[i] = i % 7;
+    e[i] = 1.5;
+    f[i] = i % 3;
+    g[i] = 2;
+  }
+
+  Vector eager_result;
+  auto start = steady_clock::now();
+  for (int rep = 0; rep < repeats; ++rep) {
+    using namespace Eager;
+    eager_result = a + b * c - 2.0 * d + e * f - g;
+  }
+  auto mid = steady_clock::now();
+  Vector fused_result(n);
+  for (int rep = 0; rep < repeats; ++rep)
+    fused_result = a + b * c - 2.0 * d + e * f - g;
+  auto end = steady_clock::now();
+
+  for (int i = 0; i < n; ++i)
+    if (eager_result[i] != fused_result[i])
+      throw std::logic_error("bench_expression: results differ");
+
+  double mb = n * sizeof(double) / 1e6;
+  double eager_ms = duration<double, std::milli>(mid - start).count() / repeats;
+  double fused_ms = duration<double, std::milli>(end - mid).count() / repeats;
+  std::cout << "n = " << n << std::endl;
+  std::cout << "eager: " << eager_ms << " ms, ~" << 16 * mb
+            << " MB moved, 6 allocations" << std::endl;
+  std::cout << "fused: " << fused_ms << " ms, ~" << 8 * mb
+            << " MB moved, 0 allocations" << std::endl;
+}
 } // namespace Container
 
 int main() {
@@ -238,5 +536,7 @@ int main() {
     std::cout << x[item] << " ";
   }
   std::cout << std::endl;
+  // Container::bench_push_back(); // 10^3 .. 10^8 pushes, needs ~2GB
+  // Container::bench_expression();
   return 0;
 }
@@ -1,8 +1,11 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <complex>
+#include <condition_variable>
+#include <cstdint>
 #include <fstream>
 #include <functional>
 #include <future>
@@ -10,12 +13,15 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <queue>
 #include <random>
 #include <regex>
 #include <set>
 #include <sstream>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -28,7 +34,13 @@ using namespace std;
     A thread is a heavyweight entity.
     -- Threads share the same address space.
     -- Communicate through shared objects via mutexes.
-    --
+    -- Creating one costs tens of microseconds, so short tasks should run on a
+       pool of long-lived threads rather than a thread each.
+
+    Work stealing
+    -- Every worker owns a deque: it pushes and pops its own tasks at the
+       bottom (LIFO, cache warm), idle workers steal from the top (FIFO).
+    -- Tasks submitted from outside the pool go through one shared queue.
 
 
 */
@@ -48,6 +60,246 @@ void user() {
 }
 } // namespace UnsafeOutput
 
+namespace WorkStealing {
+using Task = function<void()>;
+
+// Chase-Lev deque, in the C11 formulation of Le, Pop, Cohen and Zappa Nardelli
+// (PPoPP 2013). Only the owner calls push() and pop(); any thread may steal().
+class Deque {
+  struct Ring {
+    int64_t capacity; // power of two
+    vector<atomic<Task *>> slots;
+
+    explicit Ring(int64_t c) : capacity{c}, slots(c) {}
+    Task *get(int64_t i) {
+      return slots[i & (capacity - 1)].load(memory_order_relaxed);
+    }
+    void put(int64_t i, Task *t) {
+      slots[i & (capacity - 1)].store(t, memory_order_relaxed);
+    }
+  };
+
+  atomic<int64_t> top{0};
+  atomic<int64_t> bottom{0};
+  atomic<Ring *> ring;
+  // A thief may still be reading a ring that was just replaced, so old rings
+  // are kept until the deque goes away.
+  vector<unique_ptr<Ring>> retired;
+
+public:
+  Deque() : ring{new Ring{64}} {}
+  ~Deque() { delete ring.load(); }
+  Deque(const Deque &) = delete;
+  Deque &operator=(const Deque &) = delete;
+
+  void push(Task *t) {
+    int64_t b = bottom.load(memory_order_relaxed);
+    int64_t tp = top.load(memory_order_acquire);
+    Ring *r = ring.load(memory_order_relaxed);
+    if (b - tp > r->capacity - 1) {
+      Ring *bigger = new Ring{r->capacity * 2};
+      for (int64_t i = tp; i < b; ++i)
+        bigger->put(i, r->get(i));
+      retired.emplace_back(r);
+      ring.store(bigger, memory_order_release);
+      r = bigger;
+    }
+    r->put(b, t);
+    bottom.store(b + 1, memory_order_release); // publishes the slot to thieves
+  }
+
+  Task *pop() {
+    int64_t b = bottom.load(memory_order_relaxed) - 1;
+    Ring *r = ring.load(memory_order_relaxed);
+    bottom.store(b, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t tp = top.load(memory_order_relaxed);
+    if (tp > b) { // empty
+      bottom.store(b + 1, memory_order_relaxed);
+      return nullptr;
+    }
+    Task *t = r->get(b);
+    if (tp == b) { // last element: race the thieves for it
+      if (!top.compare_exchange_strong(tp, tp + 1, memory_order_seq_cst,
+                                       memory_order_relaxed))
+        t = nullptr;
+      bottom.store(b + 1, memory_order_relaxed);
+    }
+    return t;
+  }
+
+  // nullptr if the deque is empty or another thread won the race.
+  Task *steal() {
+    int64_t tp = top.load(memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+    int64_t b = bottom.load(memory_order_acquire);
+    if (tp >= b)
+      return nullptr;
+    Task *t = ring.load(memory_order_acquire)->get(tp);
+    if (!top.compare_exchange_strong(tp, tp + 1, memory_order_seq_cst,
+                                     memory_order_relaxed))
+      return nullptr;
+    return t;
+  }
+};
+
+class ThreadPool {
+public:
+  explicit ThreadPool(unsigned n = max(1u, thread::hardware_concurrency())) {
+    for (unsigned i = 0; i < n; ++i)
+      deques.push_back(make_unique<Deque>());
+    for (unsigned i = 0; i < n; ++i)
+      threads.emplace_back([this, i] { worker(i); });
+  }
+  ~ThreadPool() {
+    stop = true;
+    {
+      unique_lock<mutex> lock{sleep_mutex};
+    }
+    sleep_cv.notify_all();
+    for (auto &t : threads)
+      t.join();
+  }
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  unsigned size() const { return threads.size(); }
+
+  template <class F> future<invoke_result_t<F>> submit(F f) {
+    auto task = make_shared<packaged_task<invoke_result_t<F>()>>(std::move(f));
+    auto result = task->get_future();
+    schedule(new Task{[task] { (*task)(); }});
+    return result;
+  }
+
+  // Like future::get(), but runs other tasks while waiting, so it is safe to
+  // call from inside a task.
+  template <class R> R wait(future<R> &f) {
+    while (f.wait_for(chrono::seconds(0)) != future_status::ready)
+      if (!run_one())
+        this_thread::yield();
+    return f.get();
+  }
+
+  // Calls body(i) for every i in [begin, end). The range is split in halves
+  // until pieces are at most grain long; the halves are pushed as tasks for
+  // other workers to steal. body must not throw.
+  template <class Body>
+  void parallel_for(size_t begin, size_t end, size_t grain, Body body) {
+    if (end <= begin)
+      return;
+    grain = max<size_t>(grain, 1);
+    atomic<size_t> remaining{end - begin};
+    function<void(size_t, size_t)> split = [&](size_t b, size_t e) {
+      while (e - b > grain) {
+        size_t mid = b + (e - b) / 2;
+        schedule(new Task{[&split, mid, e] { split(mid, e); }});
+        e = mid;
+      }
+      for (size_t i = b; i < e; ++i)
+        body(i);
+      remaining.fetch_sub(e - b, memory_order_release);
+    };
+    split(begin, end);
+    while (remaining.load(memory_order_acquire) > 0)
+      if (!run_one())
+        this_thread::yield();
+  }
+
+private:
+  void schedule(Task *t) {
+    if (current_pool == this) {
+      deques[current_index]->push(t);
+    } else {
+      unique_lock<mutex> lock{inject_mutex};
+      injected.push(t);
+      injected_size.fetch_add(1, memory_order_relaxed);
+    }
+    pending.fetch_add(1);
+    if (sleepers.load() > 0) {
+      { unique_lock<mutex> lock{sleep_mutex}; }
+      sleep_cv.notify_one();
+    }
+  }
+
+  Task *find_task() {
+    Task *t = nullptr;
+    bool inside = current_pool == this;
+    if (inside)
+      t = deques[current_index]->pop();
+    if (!t && injected_size.load(memory_order_relaxed) > 0) {
+      unique_lock<mutex> lock{inject_mutex};
+      if (!injected.empty()) {
+        t = injected.front();
+        injected.pop();
+        injected_size.fetch_sub(1, memory_order_relaxed);
+      }
+    }
+    for (size_t k = 0; !t && k < deques.size(); ++k) {
+      size_t victim = (steal_seed + k) % deques.size();
+      if (!(inside && victim == current_index))
+        t = deques[victim]->steal();
+    }
+    steal_seed = steal_seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    if (t)
+      pending.fetch_sub(1);
+    return t;
+  }
+
+  bool run_one() {
+    Task *t = find_task();
+    if (!t)
+      return false;
+    (*t)();
+    delete t;
+    return true;
+  }
+
+  void worker(unsigned index) {
+    current_pool = this;
+    current_index = index;
+    steal_seed = index;
+    for (;;) {
+      bool ran = false;
+      for (int spin = 0; spin < 64 && !(ran = run_one()); ++spin)
+        this_thread::yield();
+      if (ran)
+        continue;
+      // Dekker-style handshake with schedule(): either we see pending > 0 or
+      // the producer sees sleepers > 0 and wakes us.
+      unique_lock<mutex> lock{sleep_mutex};
+      sleepers.fetch_add(1);
+      sleep_cv.wait(lock, [this] { return stop || pending.load() > 0; });
+      sleepers.fetch_sub(1);
+      if (stop && pending.load() <= 0)
+        return;
+    }
+  }
+
+  vector<unique_ptr<Deque>> deques;
+  vector<thread> threads;
+
+  mutex inject_mutex; // tasks from threads outside the pool
+  queue<Task *> injected;
+  atomic<size_t> injected_size{0};
+
+  mutex sleep_mutex;
+  condition_variable sleep_cv;
+  atomic<int64_t> pending{0}; // scheduled but not yet taken
+  atomic<int> sleepers{0};
+  atomic<bool> stop{false};
+
+  inline static thread_local ThreadPool *current_pool = nullptr;
+  inline static thread_local unsigned current_index = 0;
+  inline static thread_local uint64_t steal_seed = 0;
+};
+
+ThreadPool &pool() {
+  static ThreadPool p;
+  return p;
+}
+} // namespace WorkStealing
+
 namespace PassingArgumentsModified {
 
 template <class Container, class T> void multiply(Container &c, T t) {
@@ -63,13 +315,22 @@ struct F {
   F(vector<double> &vv) : v{vv} {}
   void operator()() { multiply(v, 2); }
 };
+// Runs on the pool; reference arguments are captured instead of ref()-wrapped.
 void user() {
   vector<double> some_vec{1, 2, 3, 4, 5, 6, 7, 8, 9};
   vector<double> vec2{10, 11, 12, 13, 14};
-  thread t1{multiply<vector<double>, int>, ref(some_vec), 2};
-  thread t2{F{vec2}};
-  t1.join();
-  t2.join();
+  auto &pool = WorkStealing::pool();
+  auto f1 = pool.submit([&] { multiply(some_vec, 2); });
+  auto f2 = pool.submit(F{vec2});
+  f1.get();
+  f2.get();
+}
+
+// Element-wise version of multiply over index ranges, without the printing.
+template <class Container, class T>
+void parallel_multiply(Container &c, T t, size_t grain = 4096) {
+  WorkStealing::pool().parallel_for(0, c.size(), grain,
+                                    [&](size_t i) { c[i] *= t; });
 }
 } // namespace PassingArgumentsModified
 
@@ -92,10 +353,11 @@ void user() {
   vector<double> res1;
   vector<double> res2;
 
-  thread t1{multiply<vector<double>, int>, ref(some_vec), ref(res1), 2};
-  thread t2{F{vec2, ref(res2)}};
-  t1.join();
-  t2.join();
+  auto &pool = WorkStealing::pool();
+  auto f1 = pool.submit([&] { multiply(some_vec, res1, 2); });
+  auto f2 = pool.submit(F{vec2, res2});
+  f1.get();
+  f2.get();
   for (auto &x : res1) {
     cout << x << " ";
   }
@@ -106,9 +368,52 @@ void user() {
 }
 } // namespace PassingArgumentsByConst
 
+namespace PoolBenchmark {
+using namespace std::chrono;
+
+void spin(nanoseconds d) {
+  auto until = steady_clock::now() + d;
+  while (steady_clock::now() < until)
+    ;
+}
+
+// Thread per task, in waves of one thread per core (what the examples above
+// used to do), against the same tasks submitted to the work-stealing pool.
+void run() {
+  auto &pool = WorkStealing::pool();
+  unsigned wave = pool.size();
+  cout << "task\ttasks\tspawn us/task\tpool us/task" << endl;
+  for (auto d : {microseconds(1), microseconds(10), microseconds(100),
+                 microseconds(1000)}) {
+    int tasks = min<int>(20000, milliseconds(200) / d);
+
+    auto start = steady_clock::now();
+    for (int i = 0; i < tasks; i += wave) {
+      vector<thread> ts;
+      for (int j = i; j < min<int>(tasks, i + wave); ++j)
+        ts.emplace_back(spin, d);
+      for (auto &t : ts)
+        t.join();
+    }
+    auto mid = steady_clock::now();
+    vector<future<void>> fs;
+    for (int i = 0; i < tasks; ++i)
+      fs.push_back(pool.submit([d] { spin(d); }));
+    for (auto &f : fs)
+      f.get();
+    auto end = steady_clock::now();
+
+    cout << d.count() << "us\t" << tasks << "\t"
+         << duration<double, micro>(mid - start).count() / tasks << "\t"
+         << duration<double, micro>(end - mid).count() / tasks << endl;
+  }
+}
+} // namespace PoolBenchmark
+
 int main() {
   // UnsafeOutput::user();
   // PassingArgumentsModified::user();
   PassingArgumentsByConst::user();
+  // PoolBenchmark::run();
   return 0;
 }
\ No newline at end of file
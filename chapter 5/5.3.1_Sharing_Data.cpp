@@ -1,8 +1,14 @@
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <chrono>
+#include <climits>
 #include <cmath>
 #include <complex>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
 #include <exception>
 #include <fstream>
 #include <functional>
@@ -11,16 +17,25 @@
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <numeric>
+#include <queue>
 #include <random>
 #include <regex>
 #include <set>
 #include <sstream>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <unordered_map>
 #include <utility>
 #include <vector>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 using namespace std;
 
 /*
@@ -43,6 +58,18 @@ using namespace std;
     - NOT for parallel computation, but for concurrent execution
     - IO bound tasks
 
+    Lock-free queues
+    - A bounded ring where producers and consumers claim slots with one
+      compare-and-swap each; no lock and no system call while it has room
+    - Only when a thread has to wait does it go to sleep in the kernel (futex)
+
+    Reduction
+    - Spawning a thread per chunk costs more than summing a small chunk
+    - Reuse a fixed set of workers and size chunks from the input instead
+    - Floating point addition is not associative: for identical totals at any
+      thread count, the chunk boundaries and the combining tree must not depend
+      on the number of threads
+
 
 */
 
@@ -62,30 +89,147 @@ void aquireServeralMutexesAtOnce() {
 namespace Events {
 using namespace std::chrono;
 
-queue<string> messages;
-condition_variable mcond;
-mutex mmutex;
+// What a producer does when the queue is at its high-water mark.
+enum class Overflow { block, reject };
 
-void consumer() {
-  int counter = 0;
-  while (true && counter < 100000) {
-    unique_lock<mutex> lock{mmutex};
-    while (messages.empty()) {
-      mcond.wait(lock);
+// Bounded message queue. Every call takes the lock once, however many
+// messages it moves, and producers wait (or are turned away) at the high-water
+// mark instead of growing the queue until memory runs out.
+class MessageQueue {
+public:
+  struct Stats {
+    size_t depth;
+    size_t max_depth;
+    uint64_t pushed;
+    uint64_t popped;
+    uint64_t rejected;
+    nanoseconds blocked; // total time producers spent waiting for room
+  };
+
+  explicit MessageQueue(size_t high_water, Overflow policy = Overflow::block)
+      : high_water{max<size_t>(high_water, 1)}, policy{policy} {}
+
+  bool push(string msg) {
+    unique_lock<mutex> lock{m};
+    if (!wait_for_room(lock)) {
+      ++counters.rejected;
+      return false;
     }
-    string msg = messages.front();
-    messages.pop();
+    messages.push_back(std::move(msg));
+    pushed_locked(1);
     lock.unlock();
-    cout << "Message received: " << ++counter << " " << msg << endl;
+    not_empty.notify_one();
+    return true;
+  }
+
+  // Moves messages out of batch front to back. Accepted messages are erased
+  // from batch; with Overflow::reject whatever did not fit stays behind.
+  // Returns the number accepted.
+  size_t push_bulk(vector<string> &batch) {
+    size_t done = 0;
+    unique_lock<mutex> lock{m};
+    while (done < batch.size()) {
+      if (!wait_for_room(lock)) {
+        counters.rejected += batch.size() - done;
+        break;
+      }
+      size_t n = min(batch.size() - done, high_water - messages.size());
+      for (size_t i = 0; i < n; ++i)
+        messages.push_back(std::move(batch[done + i]));
+      done += n;
+      pushed_locked(n);
+      not_empty.notify_all();
+    }
+    lock.unlock();
+    batch.erase(batch.begin(), batch.begin() + done);
+    return done;
+  }
+
+  // Appends up to max_n messages to out without waiting. Returns the number
+  // moved.
+  size_t try_pop_bulk(vector<string> &out, size_t max_n) {
+    unique_lock<mutex> lock{m};
+    return pop_locked(lock, out, max_n);
+  }
+
+  // Like try_pop_bulk, but waits until at least one message is available.
+  size_t pop_bulk(vector<string> &out, size_t max_n) {
+    unique_lock<mutex> lock{m};
+    not_empty.wait(lock, [this] { return !messages.empty(); });
+    return pop_locked(lock, out, max_n);
+  }
+
+  Stats stats() {
+    unique_lock<mutex> lock{m};
+    Stats s = counters;
+    s.depth = messages.size();
+    return s;
+  }
+
+private:
+  bool wait_for_room(unique_lock<mutex> &lock) {
+    if (messages.size() < high_water)
+      return true;
+    if (policy == Overflow::reject)
+      return false;
+    auto start = steady_clock::now();
+    ++waiting_producers;
+    not_full.wait(lock, [this] { return messages.size() < high_water; });
+    --waiting_producers;
+    counters.blocked += steady_clock::now() - start;
+    return true;
+  }
+
+  void pushed_locked(size_t n) {
+    counters.pushed += n;
+    counters.max_depth = max(counters.max_depth, messages.size());
+  }
+
+  size_t pop_locked(unique_lock<mutex> &lock, vector<string> &out,
+                    size_t max_n) {
+    size_t n = min(max_n, messages.size());
+    for (size_t i = 0; i < n; ++i) {
+      out.push_back(std::move(messages.front()));
+      messages.pop_front();
+    }
+    counters.popped += n;
+    bool wake = n > 0 && waiting_producers > 0;
+    lock.unlock();
+    if (wake)
+      not_full.notify_all();
+    return n;
+  }
+
+  const size_t high_water;
+  const Overflow policy;
+  deque<string> messages;
+  mutex m;
+  condition_variable not_empty;
+  condition_variable not_full;
+  int waiting_producers = 0;
+  Stats counters{};
+};
+
+MessageQueue messages{1024};
+
+void consumer() {
+  int counter = 0;
+  vector<string> batch;
+  while (counter < 100000) {
+    batch.clear();
+    messages.pop_bulk(batch, 256);
+    for (auto &msg : batch)
+      cout << "Message received: " << ++counter << " " << msg << endl;
   }
 }
 void producer() {
   int counter = 0;
-  while (true && counter < 100000) {
+  vector<string> batch;
+  while (counter < 100000) {
     cout << "Message Sent: " << counter << endl;
-    unique_lock<mutex> lock{mmutex};
-    messages.push("Hello" + to_string(++counter));
-    mcond.notify_one();
+    batch.push_back("Hello" + to_string(++counter));
+    if (batch.size() == 64 || counter == 100000)
+      messages.push_bulk(batch);
   }
 }
 void user() {
@@ -93,10 +237,334 @@ void user() {
   thread t2{producer};
   t1.join();
   t2.join();
+  auto s = messages.stats();
+  cout << "pushed " << s.pushed << ", popped " << s.popped << ", max depth "
+       << s.max_depth << ", producers blocked "
+       << duration_cast<milliseconds>(s.blocked).count() << " ms" << endl;
 }
 
 } // namespace Events
 
+namespace LockFree {
+// Vyukov's bounded multi-producer multi-consumer queue. Every cell carries a
+// sequence number that says whose turn it is: seq == pos means free for the
+// producer claiming pos, seq == pos + 1 means full for the consumer at pos.
+template <class T> class MpmcQueue {
+  struct Cell {
+    atomic<size_t> seq;
+    T value;
+  };
+
+public:
+  using value_type = T;
+
+  explicit MpmcQueue(size_t capacity) {
+    size_t n = 2;
+    while (n < capacity)
+      n *= 2;
+    cells = make_unique<Cell[]>(n);
+    mask = n - 1;
+    for (size_t i = 0; i < n; ++i)
+      cells[i].seq.store(i, memory_order_relaxed);
+  }
+
+  // v is moved from only if the push succeeds.
+  bool try_push(T &&v) {
+    size_t pos = enqueue_pos.load(memory_order_relaxed);
+    for (;;) {
+      Cell &c = cells[pos & mask];
+      size_t seq = c.seq.load(memory_order_acquire);
+      intptr_t diff = intptr_t(seq) - intptr_t(pos);
+      if (diff == 0) {
+        if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                              memory_order_relaxed)) {
+          c.value = std::move(v);
+          c.seq.store(pos + 1, memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false; // full
+      } else {
+        pos = enqueue_pos.load(memory_order_relaxed);
+      }
+    }
+  }
+
+  bool try_pop(T &out) {
+    size_t pos = dequeue_pos.load(memory_order_relaxed);
+    for (;;) {
+      Cell &c = cells[pos & mask];
+      size_t seq = c.seq.load(memory_order_acquire);
+      intptr_t diff = intptr_t(seq) - intptr_t(pos + 1);
+      if (diff == 0) {
+        if (dequeue_pos.compare_exchange_weak(pos, pos + 1,
+                                              memory_order_relaxed)) {
+          out = std::move(c.value);
+          c.seq.store(pos + mask + 1, memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false; // empty
+      } else {
+        pos = dequeue_pos.load(memory_order_relaxed);
+      }
+    }
+  }
+
+private:
+  unique_ptr<Cell[]> cells;
+  size_t mask;
+  // Producers and consumers hammer different counters: keep them on
+  // different cache lines.
+  alignas(64) atomic<size_t> enqueue_pos{0};
+  alignas(64) atomic<size_t> dequeue_pos{0};
+};
+
+// Single producer, single consumer: no compare-and-swap at all. Each side also
+// caches the other side's index and only rereads it when the ring looks full
+// (or empty), which keeps the shared cache lines quiet.
+template <class T> class SpscQueue {
+public:
+  using value_type = T;
+
+  explicit SpscQueue(size_t capacity) {
+    size_t n = 2;
+    while (n < capacity)
+      n *= 2;
+    slots = make_unique<T[]>(n);
+    mask = n - 1;
+  }
+
+  bool try_push(T &&v) {
+    size_t t = tail.load(memory_order_relaxed);
+    if (t - cached_head > mask) {
+      cached_head = head.load(memory_order_acquire);
+      if (t - cached_head > mask)
+        return false;
+    }
+    slots[t & mask] = std::move(v);
+    tail.store(t + 1, memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T &out) {
+    size_t h = head.load(memory_order_relaxed);
+    if (h == cached_tail) {
+      cached_tail = tail.load(memory_order_acquire);
+      if (h == cached_tail)
+        return false;
+    }
+    out = std::move(slots[h & mask]);
+    head.store(h + 1, memory_order_release);
+    return true;
+  }
+
+private:
+  unique_ptr<T[]> slots;
+  size_t mask;
+  alignas(64) atomic<size_t> head{0}; // consumer
+  size_t cached_tail = 0;
+  alignas(64) atomic<size_t> tail{0}; // producer
+  size_t cached_head = 0;
+};
+
+// Wait until attempt() succeeds: spin, then yield, then sleep in the kernel.
+// notify() costs one fence and one load unless somebody is actually asleep.
+class Parking {
+public:
+  template <class Attempt> void wait_until(Attempt attempt) {
+    for (int i = 0; i < 128; ++i) {
+      if (attempt())
+        return;
+      if (i >= 64)
+        this_thread::yield();
+    }
+    for (;;) {
+      uint32_t s = seq.load();
+      waiters.fetch_add(1);
+      if (attempt()) {
+        waiters.fetch_sub(1);
+        return;
+      }
+      sleep(s);
+      waiters.fetch_sub(1);
+    }
+  }
+
+  void notify() {
+    atomic_thread_fence(memory_order_seq_cst);
+    if (waiters.load() > 0) {
+      seq.fetch_add(1);
+      wake();
+    }
+  }
+
+private:
+  // Returns at once if seq has moved on from s, so a wakeup between
+  // attempt() and sleep() is never lost.
+  void sleep(uint32_t s) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAIT_PRIVATE,
+            s, nullptr, nullptr, 0);
+#else
+    while (seq.load() == s)
+      this_thread::sleep_for(chrono::microseconds(50));
+#endif
+  }
+  void wake() {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&seq), FUTEX_WAKE_PRIVATE,
+            INT_MAX, nullptr, nullptr, 0);
+#endif
+  }
+
+  atomic<uint32_t> seq{0};
+  atomic<uint32_t> waiters{0};
+};
+
+// push() blocks while the queue is full, pop() while it is empty.
+template <class Queue> class Blocking {
+public:
+  using T = typename Queue::value_type;
+
+  explicit Blocking(size_t capacity) : q{capacity} {}
+
+  bool try_push(T &&v) {
+    if (!q.try_push(std::move(v)))
+      return false;
+    not_empty.notify();
+    return true;
+  }
+  bool try_pop(T &out) {
+    if (!q.try_pop(out))
+      return false;
+    not_full.notify();
+    return true;
+  }
+  void push(T v) {
+    not_full.wait_until([&] { return q.try_push(std::move(v)); });
+    not_empty.notify();
+  }
+  T pop() {
+    T v;
+    not_empty.wait_until([&] { return q.try_pop(v); });
+    not_full.notify();
+    return v;
+  }
+
+private:
+  Queue q;
+  Parking not_empty;
+  Parking not_full;
+};
+
+// Events::producer/consumer over the lock-free queue.
+Blocking<MpmcQueue<string>> messages{1024};
+
+void consumer() {
+  for (int counter = 0; counter < 100000;)
+    cout << "Message received: " << ++counter << " " << messages.pop() << endl;
+}
+void producer() {
+  for (int counter = 0; counter < 100000;) {
+    cout << "Message Sent: " << counter << endl;
+    messages.push("Hello" + to_string(++counter));
+  }
+}
+void user() {
+  thread t1{consumer};
+  thread t2{producer};
+  t1.join();
+  t2.join();
+}
+} // namespace LockFree
+
+namespace QueueBenchmark {
+using namespace std::chrono;
+
+struct Message {
+  steady_clock::time_point sent;
+  string text;
+};
+
+// The original Events design: unbounded std::queue, one lock and one notify
+// per message.
+class LockedQueue {
+public:
+  void push(Message m) {
+    unique_lock<mutex> lock{mmutex};
+    messages.push(std::move(m));
+    mcond.notify_one();
+  }
+  Message pop() {
+    unique_lock<mutex> lock{mmutex};
+    mcond.wait(lock, [this] { return !messages.empty(); });
+    Message m = std::move(messages.front());
+    messages.pop();
+    return m;
+  }
+
+private:
+  queue<Message> messages;
+  mutex mmutex;
+  condition_variable mcond;
+};
+
+// n producers and n consumers move `total` messages through q. Prints
+// throughput and the average / 99th percentile send-to-receive latency.
+template <class Queue>
+void measure(const char *name, Queue &q, int n, int total) {
+  int per_thread = total / n;
+  vector<vector<double>> latencies(n);
+  vector<thread> threads;
+  auto start = steady_clock::now();
+  for (int i = 0; i < n; ++i) {
+    threads.emplace_back([&q, per_thread] {
+      for (int k = 0; k < per_thread; ++k)
+        q.push(Message{steady_clock::now(), "Hello" + to_string(k)});
+    });
+    threads.emplace_back([&q, &lat = latencies[i], per_thread] {
+      lat.reserve(per_thread);
+      for (int k = 0; k < per_thread; ++k) {
+        Message m = q.pop();
+        lat.push_back(duration<double, micro>(steady_clock::now() - m.sent)
+                          .count());
+      }
+    });
+  }
+  for (auto &t : threads)
+    t.join();
+  auto elapsed = duration<double>(steady_clock::now() - start).count();
+
+  vector<double> all;
+  for (auto &l : latencies)
+    all.insert(all.end(), l.begin(), l.end());
+  sort(all.begin(), all.end());
+  double avg = accumulate(all.begin(), all.end(), 0.0) / all.size();
+  cout << name << "\t" << n << "x" << n << "\t"
+       << per_thread * n / elapsed / 1e6 << "\t" << avg << "\t"
+       << all[all.size() * 99 / 100] << endl;
+}
+
+void run(int total = 1 << 20) {
+  cout << "queue\tthreads\tMmsg/s\tavg us\tp99 us" << endl;
+  for (int n : {1, 2, 4, 8, 16}) {
+    {
+      LockedQueue q;
+      measure("mutex", q, n, total);
+    }
+    {
+      LockFree::Blocking<LockFree::MpmcQueue<Message>> q{1024};
+      measure("mpmc", q, n, total);
+    }
+    if (n == 1) {
+      LockFree::Blocking<LockFree::SpscQueue<Message>> q{1024};
+      measure("spsc", q, n, total);
+    }
+  }
+}
+} // namespace QueueBenchmark
+
 namespace FuturesAndPromises {
 template <class X> void task(promise<X> &px) {
   this_thread::sleep_for(chrono::seconds(1));
@@ -121,49 +589,230 @@ void user() {
 }
 } // namespace FuturesAndPromises
 
-namespace PackagedTasks {
-double accum(vector<double>::iterator begin, vector<double>::iterator end,
-             double init) {
-  return accumulate(begin, end, init);
+namespace Reduction {
+// A fixed set of threads fed from one task queue. Tasks are packaged_tasks, so
+// submit() hands back a future exactly like std::async would, but no thread is
+// created per call.
+class Workers {
+public:
+  explicit Workers(unsigned n) {
+    for (unsigned i = 0; i < n; ++i)
+      threads.emplace_back([this] { run(); });
+  }
+  ~Workers() {
+    {
+      unique_lock<mutex> lock{m};
+      done = true;
+    }
+    cv.notify_all();
+    for (auto &t : threads)
+      t.join();
+  }
+  Workers(const Workers &) = delete;
+  Workers &operator=(const Workers &) = delete;
+
+  unsigned size() const { return threads.size(); }
+
+  template <class F> future<invoke_result_t<F>> submit(F f) {
+    auto task = make_shared<packaged_task<invoke_result_t<F>()>>(std::move(f));
+    auto result = task->get_future();
+    {
+      unique_lock<mutex> lock{m};
+      tasks.push([task] { (*task)(); });
+    }
+    cv.notify_one();
+    return result;
+  }
+
+private:
+  void run() {
+    for (;;) {
+      function<void()> task;
+      {
+        unique_lock<mutex> lock{m};
+        cv.wait(lock, [this] { return done || !tasks.empty(); });
+        if (tasks.empty())
+          return;
+        task = std::move(tasks.front());
+        tasks.pop();
+      }
+      task();
+    }
+  }
+
+  vector<thread> threads;
+  queue<function<void()>> tasks;
+  mutex m;
+  condition_variable cv;
+  bool done = false;
+};
+
+// Process-wide pool, started on first use.
+Workers &workers() {
+  static Workers pool{max(1u, thread::hardware_concurrency())};
+  return pool;
 }
 
-double comp2() {
-  using Task_type =
-      double(vector<double>::iterator, vector<double>::iterator, double);
+enum class Summation { naive, pairwise, kahan };
 
-  packaged_task<Task_type> pt0{accum};
-  packaged_task<Task_type> pt1{accum};
-  future<double> f0{pt0.get_future()};
-  future<double> f1{pt1.get_future()};
-  vector<double> v1{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+struct Options {
+  Summation summation = Summation::naive;
+  // Fixed chunk size and combining tree: bit-identical at any thread count.
+  bool reproducible = false;
+};
 
-  thread t1{std::move(pt0), v1.begin(), v1.begin() + v1.size() / 2, 0};
-  thread t2{std::move(pt1), v1.begin() + v1.size() / 2, v1.end(), 0};
-  t1.join();
-  t2.join();
-  return f0.get() + f1.get();
+constexpr size_t min_grain = 4096;   // below this a chunk isn't worth a task
+constexpr size_t fixed_grain = 4096; // chunk size in reproducible mode
+constexpr size_t chunks_per_worker = 4; // slack for uneven progress
+
+double pairwise(const double *first, size_t n) {
+  if (n <= 8) {
+    double s = 0;
+    for (size_t i = 0; i < n; ++i)
+      s += first[i];
+    return s;
+  }
+  size_t half = n / 2;
+  return pairwise(first, half) + pairwise(first + half, n - half);
 }
-} // namespace PackagedTasks
 
-namespace Async {
-double accum(vector<double>::iterator begin, vector<double>::iterator end,
-             double init) {
-  return accumulate(begin, end, init);
+double kahan(const double *first, size_t n) {
+  double s = 0, c = 0;
+  for (size_t i = 0; i < n; ++i) {
+    double y = first[i] - c;
+    double t = s + y;
+    c = (t - s) - y;
+    s = t;
+  }
+  return s;
 }
 
-double comp4() {
-  vector<double> v{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+double leaf(const double *first, size_t n, Summation summation) {
+  switch (summation) {
+  case Summation::pairwise:
+    return pairwise(first, n);
+  case Summation::kahan:
+    return kahan(first, n);
+  default:
+    return accumulate(first, first + n, 0.0);
+  }
+}
+
+double sum(const double *first, const double *last, Options opt = {},
+           Workers &pool = workers()) {
+  size_t n = last - first;
+  size_t grain = fixed_grain;
+  if (!opt.reproducible)
+    grain = max(min_grain, n / (pool.size() * chunks_per_worker) + 1);
+  size_t chunks = (n + grain - 1) / grain;
+  if (chunks <= 1)
+    return leaf(first, n, opt.summation);
+
+  // Workers pull chunk indices until none are left; the caller joins in and
+  // then waits only for chunks that are already being summed. Helpers still
+  // queued behind other tasks find nothing left and return at once, so a busy
+  // pool (even one whose workers are all inside sum()) only costs parallelism,
+  // never progress. The state is shared because such helpers may run after
+  // this call has returned.
+  struct State {
+    vector<double> partial;
+    atomic<size_t> next{0};
+    size_t done = 0; // chunks finished, guarded by m
+    mutex m;
+    condition_variable cv;
+  };
+  auto state = make_shared<State>();
+  state->partial.resize(chunks);
+  auto drain = [state, first, n, grain, chunks, summation = opt.summation] {
+    size_t finished = 0;
+    for (size_t c; (c = state->next++) < chunks; ++finished) {
+      size_t begin = c * grain;
+      state->partial[c] = leaf(first + begin, min(grain, n - begin), summation);
+    }
+    if (finished == 0)
+      return;
+    unique_lock<mutex> lock{state->m};
+    state->done += finished;
+    if (state->done == chunks)
+      state->cv.notify_all();
+  };
+  for (size_t i = 1; i < min<size_t>(pool.size(), chunks); ++i)
+    pool.submit(drain);
+  drain();
+  {
+    unique_lock<mutex> lock{state->m};
+    state->cv.wait(lock, [&] { return state->done == chunks; });
+  }
+
+  // Partials are combined in index order with a fixed tree shape, whichever
+  // thread produced them.
+  return pairwise(state->partial.data(), chunks);
+}
 
-  auto start = v.begin();
-  auto mid = v.begin() + v.size() / 2;
-  auto size = v.size();
-  auto end = v.end();
+double sum(vector<double>::iterator begin, vector<double>::iterator end,
+           double init, Options opt = {}) {
+  if (begin == end)
+    return init;
+  return init + sum(&*begin, &*begin + (end - begin), opt);
+}
+
+void user() {
+  vector<double> v(10000000);
+  mt19937_64 gen{42};
+  uniform_real_distribution<double> dist{-1e6, 1e6};
+  for (auto &x : v)
+    x = dist(gen);
+
+  Options opt{Summation::kahan, true};
+  cout.precision(17);
+  for (unsigned threads : {1u, 2u, 3u, 8u}) {
+    Workers pool{threads};
+    cout << threads << " threads: " << sum(v.data(), v.data() + v.size(), opt, pool)
+         << endl;
+  }
+}
+
+// Reproducible mode promises the same bits at any thread count: checked for
+// every summation, on input whose sum depends on the order of the additions.
+void test_reproducible() {
+  vector<double> v(1000003);
+  mt19937_64 gen{7};
+  uniform_real_distribution<double> dist{-1e6, 1e6};
+  for (auto &x : v)
+    x = dist(gen) * (gen() % 2 ? 1e-8 : 1);
+
+  for (Summation s : {Summation::naive, Summation::pairwise, Summation::kahan}) {
+    Options opt{s, true};
+    double expected = 0;
+    for (unsigned threads : {1u, 2u, 3u, 5u, 8u, 16u}) {
+      Workers pool{threads};
+      double got = sum(v.data(), v.data() + v.size(), opt, pool);
+      if (threads == 1)
+        expected = got;
+      else if (memcmp(&got, &expected, sizeof got) != 0)
+        throw runtime_error("Reduction: " + to_string(threads) +
+                            " threads changed the bits of a reproducible sum");
+    }
+  }
+  cout << "Reduction: reproducible sums are bit-identical on 1 to 16 threads"
+       << endl;
+}
+} // namespace Reduction
+
+namespace PackagedTasks {
+// Formerly two hand-made packaged_tasks on two new threads; chunking and
+// threads now come from Reduction.
+double comp2() {
+  vector<double> v1{1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  return Reduction::sum(v1.begin(), v1.end(), 0);
+}
+} // namespace PackagedTasks
 
-  auto f0 = async(accum, start, start + size / 4, 0.0);
-  auto f1 = async(accum, start + size / 4, start + size / 2, 0.0);
-  auto f2 = async(accum, start + size / 2, start + size * 3 / 4, 0.0);
-  auto f3 = async(accum, start + size * 3 / 4, end, 0.0);
-  return f0.get() + f1.get() + f2.get() + f3.get();
+namespace Async {
+// Formerly four std::async calls over fixed quarters of the input.
+double comp4() {
+  vector<double> v{1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+  return Reduction::sum(v.begin(), v.end(), 0.0);
 }
 
 int main() {
@@ -176,5 +825,9 @@ int main() {
   // FuturesAndPromises::user();
   // double res = PackagedTasks::comp2();
   Async::main();
+  Reduction::test_reproducible();
+  // Reduction::user();
+  // LockFree::user();
+  // QueueBenchmark::run();
   return 0;
 }
\ No newline at end of file